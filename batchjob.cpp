@@ -0,0 +1,378 @@
+#include "batchjob.h"
+#include "cellstore.h"
+#include "csvfile.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+#include <QTextCodec>
+#include <QTextStream>
+
+// the file is read, filtered and written this much at a time
+static const qint64 CHUNK_SIZE = 16 << 20;
+
+namespace
+{
+    // where the last two rows of a piece end
+    struct LastRows
+    {
+        LastRows() : end(0), previous(0) {}
+
+        void field(const char *, const char *, bool) {
+        }
+
+        void row(qint64 rowEnd) {
+            previous = end;
+            end = rowEnd;
+        }
+
+        qint64 end;
+        qint64 previous;
+    };
+}
+
+BatchJob::BatchJob()
+    : m_bytesIn(0), m_rowsIn(0), m_rowsOut(0)
+{
+}
+
+int BatchJob::run(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Filters, sorts and selects columns of a csv file.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("file", "File to read");
+    parser.addOptions({
+        {"batch", "Run without the window."},
+        {{"o", "output"}, "File to write, standard output if not given.", "file"},
+        {"filter", "Keep the rows matching the expression.", "expression"},
+        {"sort", "Sort by the columns, each optionally followed by :desc.", "columns"},
+        {"columns", "Write only these columns, in this order.", "columns"},
+    });
+    parser.process(arguments);
+
+    if (parser.positionalArguments().size() != 1) {
+        return _fail("expected exactly one input file");
+    }
+
+    m_output = parser.value("output");
+    m_filterText = parser.value("filter");
+    if (parser.isSet("sort")) {
+        m_sortSpecs = parser.value("sort").split(',');
+    }
+    if (parser.isSet("columns")) {
+        m_columnNames = parser.value("columns").split(',');
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QString input = parser.positionalArguments()[0];
+    int result = m_sortSpecs.isEmpty() ? _stream(input) : _sortAll(input);
+    if (result != 0) {
+        return result;
+    }
+
+    double seconds = qMax(timer.nsecsElapsed() / 1e9, 1e-9);
+    double mb = m_bytesIn / 1048576.0;
+    QTextStream(stderr) << QString("%1 rows in, %2 rows out, %3 MB in %4 s (%5 MB/s, %6 rows/s)")
+                           .arg(m_rowsIn).arg(m_rowsOut)
+                           .arg(mb, 0, 'f', 1).arg(seconds, 0, 'f', 2)
+                           .arg(mb / seconds, 0, 'f', 1).arg(qint64(m_rowsIn / seconds))
+                        << "\n";
+    return 0;
+}
+
+int BatchJob::_stream(const QString &input)
+{
+    CsvFile file;
+    if (!file.open(input, false)) {
+        // not utf-8 or not mappable, it is decoded as it is read
+        return _streamDecoded(input);
+    }
+
+    CSV::Dialect dialect = file.dialect();
+    CSV::Dialect chunkDialect = dialect;
+    chunkDialect.bom = 0;
+
+    m_bytesIn = file.size();
+
+    CellStore store;
+    CellGrid header;
+    qint64 from = dialect.bom;
+    qint64 length = CHUNK_SIZE;
+
+    while (from < file.size()) {
+        // whole rows only, a row longer than a chunk makes the chunk grow
+        QVector<qint64> ends;
+        CSV::LineEndings endings;
+        bool last = from + length >= file.size();
+        qint64 next = file.scanRows(from, qMin(length, file.size() - from), ends, endings);
+        if (next == from) {
+            if (last)
+                break;
+            length *= 2;
+            continue;
+        }
+        length = CHUNK_SIZE;
+
+        QVector<CellGrid> grids = CSV::parseGrids(QByteArray::fromRawData(file.data() + from, int(next - from)),
+                                                  chunkDialect);
+        if (!_writePiece(grids, dialect, store, header)) {
+            return 1;
+        }
+        from = next;
+    }
+
+    if (!m_writer && !_open(dialect, store)) {
+        return 1;
+    }
+    return _finish();
+}
+
+int BatchJob::_streamDecoded(const QString &input)
+{
+    QFile in(input);
+    if (!in.open(QIODevice::ReadOnly)) {
+        return _fail("cannot open " + input);
+    }
+
+    QByteArray raw = in.read(CHUNK_SIZE);
+    CSV::Dialect dialect = CSV::sniff(raw.constData(), raw.size());
+    QTextCodec * codec = QTextCodec::codecForName(dialect.codec);
+    if (!codec) {
+        return _fail(QString("cannot read %1, no support for %2").arg(input, QString(dialect.codec)));
+    }
+
+    // the decoder keeps characters cut in two by the end of a chunk
+    QScopedPointer<QTextDecoder> decoder(codec->makeDecoder());
+    m_bytesIn = raw.size();
+    raw.remove(0, dialect.bom);
+
+    CSV::Dialect chunkDialect = dialect;
+    chunkDialect.bom = 0;
+    chunkDialect.codec = "UTF-8";
+
+    CellStore store;
+    CellGrid header;
+    QByteArray pending;
+    for (;;) {
+        pending += decoder->toUnicode(raw).toUtf8();
+        bool last = in.atEnd();
+
+        // whole rows only, unless this is the end of the file the last
+        // row may be cut off
+        qint64 next = pending.size();
+        if (!last) {
+            LastRows rows;
+            CSV::tokenizeRows(pending.constData(), pending.size(), rows, chunkDialect);
+            next = rows.end == pending.size() && !pending.endsWith('\n') ? rows.previous : rows.end;
+        }
+
+        if (next > 0) {
+            QVector<CellGrid> grids = CSV::parseGrids(QByteArray::fromRawData(pending.constData(), int(next)),
+                                                      chunkDialect);
+            if (!_writePiece(grids, dialect, store, header)) {
+                return 1;
+            }
+            pending.remove(0, int(next));
+        }
+        if (last)
+            break;
+
+        raw = in.read(CHUNK_SIZE);
+        if (raw.isEmpty() && in.error() != QFileDevice::NoError) {
+            return _fail("cannot read " + input);
+        }
+        m_bytesIn += raw.size();
+    }
+
+    if (!m_writer && !_open(dialect, store)) {
+        return 1;
+    }
+    return _finish();
+}
+
+bool BatchJob::_writePiece(QVector<CellGrid> grids, const CSV::Dialect &dialect,
+                           CellStore &store, CellGrid &header)
+{
+    // every piece is read once, finding column types would not pay off
+    if (header.rowCount() > 0) {
+        grids.prepend(header);
+    }
+    store.load(grids, false);
+
+    if (header.rowCount() == 0) {
+        if (!_prepare(store) || !_open(dialect, store)) {
+            return false;
+        }
+        header.addRow();
+        for (int c = 0; c < store.columnCount(); ++c) {
+            header.addCell(store.header(c));
+        }
+    }
+
+    m_rowsIn += store.rowCount();
+    _write(store, _select(store));
+    return true;
+}
+
+int BatchJob::_sortAll(const QString &input)
+{
+    CellStore store;
+    CSV::Dialect dialect;
+    if (!_loadAll(input, store, dialect)) {
+        return _fail("cannot open " + input);
+    }
+    if (!_prepare(store) || !_open(dialect, store)) {
+        return 1;
+    }
+
+    m_rowsIn = store.rowCount();
+    if (!m_keys.isEmpty()) {
+        store.setRowOrder(Sorter(m_keys).sort(store));
+    }
+    _write(store, _select(store));
+    return _finish();
+}
+
+bool BatchJob::_loadAll(const QString &input, CellStore &store, CSV::Dialect &dialect)
+{
+    QSharedPointer<CsvFile> file(new CsvFile);
+    if (file->open(input)) {
+        store.attach(file);
+        dialect = file->dialect();
+        dialect.crlf = file->crlf();
+        m_bytesIn = file->size();
+        return true;
+    }
+
+    QFile in(input);
+    if (!in.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray bytes = in.readAll();
+    in.close();
+
+    dialect = CSV::sniff(bytes.constData(), bytes.size());
+    store.load(CSV::parseGrids(bytes, dialect));
+    m_bytesIn = bytes.size();
+    return true;
+}
+
+bool BatchJob::_prepare(const CellStore &store)
+{
+    QStringList headers;
+    for (int c = 0; c < store.columnCount(); ++c) {
+        headers.append(store.header(c));
+    }
+
+    m_columns.clear();
+    foreach (const QString &name, m_columnNames) {
+        int c = headers.indexOf(name);
+        if (c < 0) {
+            _fail("no column " + name);
+            return false;
+        }
+        m_columns.append(c);
+    }
+    if (m_columnNames.isEmpty()) {
+        for (int c = 0; c < headers.size(); ++c) {
+            m_columns.append(c);
+        }
+    }
+
+    m_keys.clear();
+    foreach (const QString &spec, m_sortSpecs) {
+        SortKey key;
+        key.order = Qt::AscendingOrder;
+
+        QString name = spec;
+        if (name.endsWith(":desc")) {
+            key.order = Qt::DescendingOrder;
+            name.chop(5);
+        } else if (name.endsWith(":asc")) {
+            name.chop(4);
+        }
+
+        key.column = headers.indexOf(name);
+        if (key.column < 0) {
+            _fail("no column " + name);
+            return false;
+        }
+        m_keys.append(key);
+    }
+
+    if (!m_filterText.isEmpty() && !m_filter.compile(m_filterText, headers)) {
+        _fail(m_filter.errorString());
+        return false;
+    }
+    return true;
+}
+
+QVector<int> BatchJob::_select(const CellStore &store)
+{
+    if (!m_filterText.isEmpty()) {
+        return m_filter.evaluate(store);
+    }
+
+    QVector<int> rows(store.rowCount());
+    for (int r = 0; r < rows.size(); ++r) {
+        rows[r] = r;
+    }
+    return rows;
+}
+
+void BatchJob::_write(const CellStore &store, const QVector<int> &rows)
+{
+    store.writeRows(*m_writer, rows, m_columns);
+    m_rowsOut += rows.size();
+}
+
+bool BatchJob::_open(const CSV::Dialect &dialect, const CellStore &store)
+{
+    if (m_output.isEmpty()) {
+        QFile * out = new QFile;
+        m_device.reset(out);
+        if (!out->open(stdout, QIODevice::WriteOnly)) {
+            _fail("cannot write to standard output");
+            return false;
+        }
+    } else {
+        m_device.reset(new QSaveFile(m_output));
+        if (!m_device->open(QIODevice::WriteOnly)) {
+            _fail("cannot write " + m_output);
+            return false;
+        }
+    }
+
+    m_writer.reset(new CSV::Writer(m_device.data(), dialect));
+    foreach (int c, m_columns) {
+        m_writer->writeField(store.header(c));
+    }
+    if (!m_columns.isEmpty()) {
+        m_writer->endRow();
+    }
+    return true;
+}
+
+int BatchJob::_finish()
+{
+    if (!m_writer->flush()) {
+        return _fail("cannot write " + (m_output.isEmpty() ? QString("standard output") : m_output));
+    }
+
+    QSaveFile * file = qobject_cast<QSaveFile *>(m_device.data());
+    if (file && !file->commit()) {
+        return _fail("cannot write " + m_output);
+    }
+    return 0;
+}
+
+int BatchJob::_fail(const QString &message)
+{
+    QTextStream(stderr) << QCoreApplication::applicationName() << ": " << message << "\n";
+    return 1;
+}
@@ -0,0 +1,67 @@
+#ifndef BATCHJOB_H
+#define BATCHJOB_H
+
+#include <QFileDevice>
+#include <QScopedPointer>
+#include <QStringList>
+#include <QVector>
+
+#include "csv.h"
+#include "rowfilter.h"
+#include "sorter.h"
+
+class CellGrid;
+class CellStore;
+
+// Runs a file through filter, sort and column selection without any GUI,
+// for scripts and cron jobs:
+//
+//   csv-editor --batch in.csv -o out.csv --filter 'status == "OK"' \
+//              --sort latency:desc --columns host,latency
+//
+// Without --sort the file is read and written a piece at a time, so memory
+// stays bounded whatever its size, files in other encodings than utf-8 are
+// decoded a piece at a time as well. Sorting needs every row, the file is
+// then mapped and only its row index and the sort keys are held.
+class BatchJob
+{
+public:
+    BatchJob();
+
+    int run(const QStringList &arguments);
+
+private:
+    int _stream(const QString &input);
+    int _streamDecoded(const QString &input);
+    bool _writePiece(QVector<CellGrid> grids, const CSV::Dialect &dialect,
+                     CellStore &store, CellGrid &header);
+    int _sortAll(const QString &input);
+    bool _loadAll(const QString &input, CellStore &store, CSV::Dialect &dialect);
+
+    bool _prepare(const CellStore &store);
+    QVector<int> _select(const CellStore &store);
+    void _write(const CellStore &store, const QVector<int> &rows);
+
+    bool _open(const CSV::Dialect &dialect, const CellStore &store);
+    int _finish();
+    int _fail(const QString &message);
+
+private:
+    QString m_output;
+    QString m_filterText;
+    QStringList m_sortSpecs;
+    QStringList m_columnNames;
+
+    RowFilter m_filter;
+    QVector<SortKey> m_keys;
+    QVector<int> m_columns;
+
+    QScopedPointer<QFileDevice> m_device;
+    QScopedPointer<CSV::Writer> m_writer;
+
+    qint64 m_bytesIn;
+    qint64 m_rowsIn;
+    qint64 m_rowsOut;
+};
+
+#endif // BATCHJOB_H
@@ -0,0 +1,1281 @@
+#include "cellstore.h"
+#include "csvfile.h"
+#include "csv.h"
+
+#include <QByteArrayMatcher>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+// compact a column once more than half of its buffer is dead bytes left
+// behind by edits, but do not bother for small columns
+static const int COMPACT_THRESHOLD = 1 << 20;
+
+// an empty cell of a typed column
+static const qint64 EMPTY_VALUE = std::numeric_limits<qint64>::min();
+
+// a column is only encoded when it has at most this many distinct values,
+// each used four times on average, and turns back into text once edits
+// would go past what a code can hold
+static const int ENCODE_WORDS = 4096;
+static const int ENCODE_USES = 4;
+static const int MAX_WORDS = 1 << 16;
+
+// decoded rows of an attached file kept around for the view
+static const int SOURCE_CACHE_ROWS = 1 << 14;
+
+// layouts of timestamp columns
+enum {
+    DATE,           // yyyy-MM-dd
+    DATE_TIME,      // yyyy-MM-dd HH:mm:ss
+    DATE_T_TIME,    // yyyy-MM-ddTHH:mm:ss
+};
+
+namespace
+{
+    // -?(0|[1-9][0-9]*), followed by a point and exactly `places` digits
+    // when places > 0, so that the value formats back to the same text
+    bool parseFixed(const char * p, int length, int places, qint64 &value)
+    {
+        const char * end = p + length;
+        bool negative = p < end && *p == '-';
+        if (negative)
+            ++p;
+
+        // 18 digits always fit, more are given up on before they overflow
+        const char * digits = p;
+        qint64 v = 0;
+        int count = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (++count > 18)
+                return false;
+            v = v * 10 + (*p++ - '0');
+        }
+        if (count == 0 || (count > 1 && *digits == '0'))
+            return false;
+
+        if (places > 0) {
+            if (p >= end || *p != '.')
+                return false;
+            const char * fraction = ++p;
+            while (p < end && *p >= '0' && *p <= '9') {
+                if (++count > 18)
+                    return false;
+                v = v * 10 + (*p++ - '0');
+            }
+            if (p - fraction != places)
+                return false;
+        }
+
+        // -0 would not come back
+        if (p != end || (negative && v == 0))
+            return false;
+
+        value = negative ? -v : v;
+        return true;
+    }
+
+    int formatFixed(qint64 value, int places, char * buffer)
+    {
+        char digits[24];
+        int n = 0;
+        quint64 u = value < 0 ? 0 - quint64(value) : quint64(value);
+        do {
+            digits[n++] = char('0' + u % 10);
+            u /= 10;
+        } while (u);
+        while (n <= places) {
+            digits[n++] = '0';
+        }
+
+        int length = 0;
+        if (value < 0)
+            buffer[length++] = '-';
+        for (int i = n - 1; i >= 0; --i) {
+            buffer[length++] = digits[i];
+            if (i == places && places > 0)
+                buffer[length++] = '.';
+        }
+        return length;
+    }
+
+    // days since 1970-01-01 in the proleptic gregorian calendar
+    qint64 daysFromCivil(int y, int m, int d)
+    {
+        y -= m <= 2;
+        qint64 era = (y >= 0 ? y : y - 399) / 400;
+        int yoe = int(y - era * 400);
+        int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + doe - 719468;
+    }
+
+    void civilFromDays(qint64 z, int &y, int &m, int &d)
+    {
+        z += 719468;
+        qint64 era = (z >= 0 ? z : z - 146096) / 146097;
+        int doe = int(z - era * 146097);
+        int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        int mp = (5 * doy + 2) / 153;
+        d = doy - (153 * mp + 2) / 5 + 1;
+        m = mp < 10 ? mp + 3 : mp - 9;
+        y = int(yoe + era * 400) + (m <= 2);
+    }
+
+    bool digitsAt(const char * p, int count, int &value)
+    {
+        value = 0;
+        for (int i = 0; i < count; ++i) {
+            if (p[i] < '0' || p[i] > '9')
+                return false;
+            value = value * 10 + (p[i] - '0');
+        }
+        return true;
+    }
+
+    bool parseTimestamp(const char * p, int length, int layout, qint64 &value)
+    {
+        if (length != (layout == DATE ? 10 : 19) || p[4] != '-' || p[7] != '-')
+            return false;
+
+        int y, m, d, hh = 0, mm = 0, ss = 0;
+        if (!digitsAt(p, 4, y) || !digitsAt(p + 5, 2, m) || !digitsAt(p + 8, 2, d))
+            return false;
+
+        if (layout != DATE) {
+            if (p[10] != (layout == DATE_TIME ? ' ' : 'T') || p[13] != ':' || p[16] != ':')
+                return false;
+            if (!digitsAt(p + 11, 2, hh) || !digitsAt(p + 14, 2, mm) || !digitsAt(p + 17, 2, ss))
+                return false;
+            if (hh > 23 || mm > 59 || ss > 59)
+                return false;
+        }
+
+        // the date must exist, 2021-02-30 does not come back
+        if (m < 1 || m > 12 || d < 1)
+            return false;
+        qint64 days = daysFromCivil(y, m, d);
+        int cy, cm, cd;
+        civilFromDays(days, cy, cm, cd);
+        if (cy != y || cm != m || cd != d)
+            return false;
+
+        value = days * 86400 + hh * 3600 + mm * 60 + ss;
+        return true;
+    }
+
+    void putDigits(char * p, int count, int value)
+    {
+        for (int i = count - 1; i >= 0; --i) {
+            p[i] = char('0' + value % 10);
+            value /= 10;
+        }
+    }
+
+    int formatTimestamp(qint64 value, int layout, char * buffer)
+    {
+        qint64 days = value >= 0 ? value / 86400 : -((-value + 86399) / 86400);
+        int seconds = int(value - days * 86400);
+
+        int y, m, d;
+        civilFromDays(days, y, m, d);
+        putDigits(buffer, 4, y);
+        buffer[4] = '-';
+        putDigits(buffer + 5, 2, m);
+        buffer[7] = '-';
+        putDigits(buffer + 8, 2, d);
+        if (layout == DATE)
+            return 10;
+
+        buffer[10] = layout == DATE_TIME ? ' ' : 'T';
+        putDigits(buffer + 11, 2, seconds / 3600);
+        buffer[13] = ':';
+        putDigits(buffer + 14, 2, seconds / 60 % 60);
+        buffer[16] = ':';
+        putDigits(buffer + 17, 2, seconds % 60);
+        return 19;
+    }
+
+    bool parseValue(CellStore::Type type, int format, const char * data, int length, qint64 &value)
+    {
+        switch (type) {
+        case CellStore::Integer:
+            return parseFixed(data, length, 0, value);
+        case CellStore::Decimal:
+            return parseFixed(data, length, format, value);
+        case CellStore::Timestamp:
+            return parseTimestamp(data, length, format, value);
+        default:
+            return false;
+        }
+    }
+
+    int formatValue(CellStore::Type type, int format, qint64 value, char * buffer)
+    {
+        if (type == CellStore::Timestamp)
+            return formatTimestamp(value, format, buffer);
+        return formatFixed(value, type == CellStore::Decimal ? format : 0, buffer);
+    }
+
+    // what a first value says the whole column may be
+    bool classify(const char * data, int length, CellStore::Type &type, int &format)
+    {
+        qint64 value;
+        if (parseFixed(data, length, 0, value)) {
+            type = CellStore::Integer;
+            format = 0;
+            return true;
+        }
+
+        const char * point = static_cast<const char *>(memchr(data, '.', length));
+        if (point) {
+            int places = int(data + length - point - 1);
+            if (places > 0 && parseFixed(data, length, places, value)) {
+                type = CellStore::Decimal;
+                format = places;
+                return true;
+            }
+        }
+
+        for (int layout = DATE; layout <= DATE_T_TIME; ++layout) {
+            if (parseTimestamp(data, length, layout, value)) {
+                type = CellStore::Timestamp;
+                format = layout;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+CellGrid::CellGrid()
+{
+}
+
+CellGrid::CellGrid(const QList<QStringList> &rows)
+{
+    foreach (const QStringList &row, rows) {
+        addRow();
+        foreach (const QString &text, row) {
+            addCell(text);
+        }
+    }
+}
+
+void CellGrid::reserve(int bytes)
+{
+    m_bytes.reserve(bytes);
+}
+
+void CellGrid::addRow()
+{
+    m_rows.append(m_ends.size());
+}
+
+void CellGrid::addCell(const char * data, int length)
+{
+    m_bytes.append(data, length);
+    m_ends.append(m_bytes.size());
+}
+
+void CellGrid::addCell(const QString &text)
+{
+    QByteArray utf8 = text.toUtf8();
+    addCell(utf8.constData(), utf8.size());
+}
+
+int CellGrid::rowCount() const
+{
+    return m_rows.size();
+}
+
+int CellGrid::columnCount(int r) const
+{
+    int end = r + 1 < m_rows.size() ? m_rows[r + 1] : m_ends.size();
+    return end - m_rows[r];
+}
+
+const char * CellGrid::data(int r, int c) const
+{
+    int i = m_rows[r] + c;
+    return m_bytes.constData() + (i == 0 ? 0 : m_ends[i - 1]);
+}
+
+int CellGrid::length(int r, int c) const
+{
+    int i = m_rows[r] + c;
+    return m_ends[i] - (i == 0 ? 0 : m_ends[i - 1]);
+}
+
+qint64 CellGrid::size() const
+{
+    return sizeof(*this) + m_bytes.capacity() + m_ends.capacity() * sizeof(quint32)
+            + m_rows.capacity() * sizeof(int);
+}
+
+CellStore::CellStore()
+    : m_rowCount(0), m_addedRows(0), m_sourceRows(0), m_sourceColumns(0)
+{
+    m_sourceBlocks.setMaxCost(SOURCE_CACHE_ROWS);
+}
+
+void CellStore::clear()
+{
+    m_columns.clear();
+    m_rowCount = 0;
+    m_addedRows = 0;
+    m_order.clear();
+
+    m_source.clear();
+    m_sourceRows = 0;
+    m_sourceColumns = 0;
+    m_sourceBlocks.clear();
+}
+
+void CellStore::load(const QVector<CellGrid> &grids, bool typed)
+{
+    clear();
+
+    int headerGrid = 0;
+    while (headerGrid < grids.size() && grids[headerGrid].rowCount() == 0) {
+        ++headerGrid;
+    }
+    if (headerGrid == grids.size()) {
+        return;
+    }
+
+    const CellGrid &first = grids[headerGrid];
+    for (int c = 0; c < first.columnCount(0); ++c) {
+        addColumn(QString::fromUtf8(first.data(0, c), first.length(0, c)));
+    }
+
+    int rows = 0;
+    foreach (const CellGrid &grid, grids) {
+        rows += grid.rowCount();
+    }
+    rows -= 1;
+
+    QVector<int> columns;
+    for (int c = 0; c < m_columns.size(); ++c) {
+        columns.append(c);
+    }
+
+    // columns are filled on all cores, each one sized up front
+    Column * data = m_columns.data();
+    QtConcurrent::blockingMap(columns, [&grids, headerGrid, rows, data](int c) {
+        Column &column = data[c];
+
+        qint64 bytes = 0;
+        for (int g = headerGrid; g < grids.size(); ++g) {
+            const CellGrid &grid = grids[g];
+            for (int r = g == headerGrid ? 1 : 0; r < grid.rowCount(); ++r) {
+                if (c < grid.columnCount(r))
+                    bytes += grid.length(r, c);
+            }
+        }
+
+        column.bytes.reserve(int(qMin<qint64>(bytes, std::numeric_limits<int>::max())));
+        column.cells.resize(rows);
+
+        int i = 0;
+        int widestRow = -1;
+        for (int g = headerGrid; g < grids.size(); ++g) {
+            const CellGrid &grid = grids[g];
+            for (int r = g == headerGrid ? 1 : 0; r < grid.rowCount(); ++r, ++i) {
+                if (c >= grid.columnCount(r))
+                    continue;
+
+                Cell &cell = column.cells[i];
+                cell.offset = column.bytes.size();
+                cell.length = grid.length(r, c);
+                column.bytes.append(grid.data(r, c), cell.length);
+
+                if (cell.length > quint32(column.widest)) {
+                    column.widest = cell.length;
+                    widestRow = i;
+                }
+            }
+        }
+        if (widestRow >= 0) {
+            const Cell &cell = column.cells[widestRow];
+            column.widestValue = column.bytes.mid(cell.offset, cell.length);
+        }
+    });
+
+    m_rowCount = rows;
+    m_addedRows = rows;
+    if (typed) {
+        inferTypes();
+    }
+}
+
+void CellStore::attach(QSharedPointer<CsvFile> file)
+{
+    clear();
+
+    // the first row of the file is the header
+    QStringList header = file->rowCount() > 0 ? file->row(0) : QStringList();
+
+    m_source = file;
+    m_sourceRows = qMax(0, file->rowCount() - 1);
+    m_rowCount = m_sourceRows;
+
+    for (int i = 0; i < header.length(); ++i) {
+        addColumn(header[i]);
+    }
+    m_sourceColumns = header.length();
+}
+
+void CellStore::appendSourceRows(const QVector<qint64> &ends, const CSV::LineEndings &endings)
+{
+    Q_ASSERT(m_source->rowCount() > 0);
+
+    // rows of the file go last, after anything added in the meantime
+    if (m_order.isEmpty() && m_addedRows > 0) {
+        _buildOrder();
+    }
+
+    int first = m_sourceRows;
+    m_source->appendRows(ends, endings);
+    m_sourceRows = m_source->rowCount() - 1;
+
+    if (!m_order.isEmpty()) {
+        m_order.reserve(m_order.size() + m_sourceRows - first);
+        for (int id = first; id < m_sourceRows; ++id) {
+            m_order.append(id);
+        }
+    }
+    m_rowCount += m_sourceRows - first;
+}
+
+void CellStore::materialize()
+{
+    if (!m_source) {
+        return;
+    }
+
+    QVector<Column> columns(m_columns.size());
+    for (int c = 0; c < m_columns.size(); ++c) {
+        columns[c].title = m_columns[c].title;
+        columns[c].cells.reserve(m_rowCount);
+    }
+
+    // row by row, so every row of the file is decoded once
+    for (int r = 0; r < m_rowCount; ++r) {
+        for (int c = 0; c < m_columns.size(); ++c) {
+            Column &column = columns[c];
+            QByteArray utf8 = text(r, c).toUtf8();
+
+            Cell cell;
+            cell.offset = column.bytes.size();
+            cell.length = utf8.size();
+            column.bytes.append(utf8);
+            column.cells.append(cell);
+
+            if (cell.length > quint32(column.widest)) {
+                column.widest = cell.length;
+                column.widestValue = utf8;
+            }
+        }
+    }
+
+    m_columns = columns;
+    m_addedRows = m_rowCount;
+    m_order.clear();
+    m_source.clear();
+    m_sourceRows = 0;
+    m_sourceColumns = 0;
+    m_sourceBlocks.clear();
+
+    inferTypes();
+}
+
+bool CellStore::isAttached() const
+{
+    return !m_source.isNull();
+}
+
+int CellStore::columnCount() const
+{
+    return m_columns.size();
+}
+
+int CellStore::rowCount() const
+{
+    return m_rowCount;
+}
+
+QString CellStore::text(int r, int c) const
+{
+    return _text(_rowId(r), c);
+}
+
+QString CellStore::_text(int id, int c) const
+{
+    const char * data;
+    int length;
+    char buffer[FORMAT_BUFFER];
+    if (!_value(m_columns.at(c), id, data, length, buffer)) {
+        return _sourceText(id, c);
+    }
+    if (length == 0) {
+        return QString();
+    }
+    return QString::fromUtf8(data, length);
+}
+
+void CellStore::setText(int r, int c, const QString &text)
+{
+    int id = _rowId(r);
+    Column &column = m_columns[c];
+    const Cell * cell = _cell(column, id);
+    if (cell) {
+        column.garbage += cell->length;
+    }
+    _store(column, id, text.toUtf8());
+    _maybeCompact(column);
+}
+
+QString CellStore::header(int c) const
+{
+    return m_columns.at(c).title;
+}
+
+void CellStore::setHeader(int c, const QString &title)
+{
+    m_columns[c].title = title;
+}
+
+void CellStore::inferTypes()
+{
+    QVector<int> columns;
+    for (int c = 0; c < m_columns.size(); ++c) {
+        if (m_columns[c].type == Text) {
+            columns.append(c);
+        }
+    }
+
+    // detach before the columns are worked on from several threads
+    Column * data = m_columns.data();
+    QtConcurrent::blockingMap(columns, [this, data](int c) {
+        _inferType(data[c]);
+    });
+}
+
+CellStore::Type CellStore::columnType(int c) const
+{
+    return m_columns.at(c).type;
+}
+
+bool CellStore::number(int r, int c, double &value) const
+{
+    const Column &column = m_columns.at(c);
+    int id = _rowId(r);
+    if (column.type == Text || column.type == Dictionary || id >= 0) {
+        return false;
+    }
+
+    qint64 v = column.values.at(-1 - id);
+    if (v == EMPTY_VALUE) {
+        return false;
+    }
+
+    // one division by an exact power of ten, as a parser would round it
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+    };
+    value = double(v);
+    if (column.type == Decimal) {
+        value /= powers[column.format];
+    }
+    return true;
+}
+
+CellStore::ColumnStats CellStore::columnStats(int c) const
+{
+    const Column &column = m_columns.at(c);
+
+    ColumnStats stats;
+    stats.type = column.type;
+    stats.distinct = qMax(0, column.words.size() - 1);
+    stats.lookups = column.lookups;
+    stats.hits = column.hits;
+    stats.bytes = column.bytes.capacity()
+            + column.cells.capacity() * qint64(sizeof(Cell))
+            + column.overrides.size() * qint64(sizeof(Cell) + sizeof(int))
+            + column.values.capacity() * qint64(sizeof(qint64))
+            + column.codes.capacity() * qint64(sizeof(quint16));
+    foreach (const QByteArray &word, column.words) {
+        stats.bytes += word.capacity() + qint64(sizeof(QByteArray) + sizeof(int));
+    }
+    return stats;
+}
+
+QString CellStore::widestText(int c) const
+{
+    const Column &column = m_columns.at(c);
+    return QString::fromUtf8(column.widestValue);
+}
+
+int CellStore::addColumn(const QString &title)
+{
+    Column column;
+    column.title = title;
+    column.cells.resize(m_addedRows);
+    m_columns.append(column);
+    return m_columns.size() - 1;
+}
+
+void CellStore::removeLastColumn()
+{
+    m_columns.removeLast();
+    m_sourceColumns = qMin(m_sourceColumns, m_columns.size());
+}
+
+QVector<int> CellStore::newRows(int count)
+{
+    QVector<int> rows(count);
+    for (int i = 0; i < count; ++i) {
+        rows[i] = -1 - (m_addedRows + i);
+    }
+
+    m_addedRows += count;
+    for (int i = 0; i < m_columns.size(); ++i) {
+        Column &column = m_columns[i];
+        if (column.type == Text)
+            column.cells.resize(m_addedRows);
+        else if (column.type == Dictionary)
+            column.codes.resize(m_addedRows);
+        else
+            column.values.insert(column.values.end(), count, EMPTY_VALUE);
+    }
+    return rows;
+}
+
+void CellStore::insertRows(int at, const QVector<int> &rows)
+{
+    int count = rows.size();
+
+    if (m_order.isEmpty()) {
+        // the rows created last, appended at the end, keep the id order
+        bool inOrder = at == m_rowCount && m_rowCount + count == m_sourceRows + m_addedRows;
+        for (int i = 0; inOrder && i < count; ++i) {
+            inOrder = rows[i] == -1 - (m_addedRows - count + i);
+        }
+        if (inOrder) {
+            m_rowCount += count;
+            return;
+        }
+        _buildOrder();
+    }
+
+    m_order.insert(at, count, 0);
+    std::copy(rows.begin(), rows.end(), m_order.begin() + at);
+    m_rowCount += count;
+}
+
+QVector<int> CellStore::removeRows(int at, int count)
+{
+    if (m_order.isEmpty()) {
+        _buildOrder();
+    }
+
+    QVector<int> rows = m_order.mid(at, count);
+    m_order.remove(at, count);
+    m_rowCount -= count;
+    return rows;
+}
+
+QVector<int> CellStore::rowOrder() const
+{
+    if (!m_order.isEmpty()) {
+        return m_order;
+    }
+
+    QVector<int> order(m_rowCount);
+    for (int r = 0; r < m_rowCount; ++r) {
+        order[r] = _rowId(r);
+    }
+    return order;
+}
+
+void CellStore::setRowOrder(const QVector<int> &order)
+{
+    Q_ASSERT(order.size() == m_rowCount);
+
+    // back in id order, e.g. after undoing a sort
+    bool inOrder = m_rowCount == m_sourceRows + m_addedRows;
+    for (int r = 0; inOrder && r < m_rowCount; ++r) {
+        inOrder = order[r] == (r < m_sourceRows ? r : m_sourceRows - 1 - r);
+    }
+
+    if (inOrder)
+        m_order.clear();
+    else
+        m_order = order;
+}
+
+void CellStore::readRange(int top, int left, int bottom, int right, CellGrid &grid) const
+{
+    _readRows(nullptr, top, bottom - top + 1, left, right, grid);
+}
+
+void CellStore::writeRange(int top, int left, int bottom, int right, const CellGrid &grid)
+{
+    _writeRows(nullptr, top, bottom - top + 1, left, right, grid);
+}
+
+void CellStore::readRows(const QVector<int> &rows, int left, int right, CellGrid &grid) const
+{
+    _readRows(rows.constData(), 0, rows.size(), left, right, grid);
+}
+
+void CellStore::writeRows(const QVector<int> &rows, int left, int right, const CellGrid &grid)
+{
+    _writeRows(rows.constData(), 0, rows.size(), left, right, grid);
+}
+
+void CellStore::_readRows(const int * rows, int top, int count, int left, int right,
+                          CellGrid &grid) const
+{
+    for (int i = 0; i < count; ++i) {
+        int id = _rowId(rows ? rows[i] : top + i);
+        grid.addRow();
+        for (int c = left; c <= right; ++c) {
+            const char * data;
+            int length;
+            char buffer[FORMAT_BUFFER];
+            if (_value(m_columns[c], id, data, length, buffer)) {
+                grid.addCell(data, length);
+            } else {
+                grid.addCell(_sourceText(id, c));
+            }
+        }
+    }
+}
+
+void CellStore::_writeRows(const int * rows, int top, int count, int left, int right,
+                           const CellGrid &grid)
+{
+    // column by column, every column buffer is appended to in one go
+    for (int c = left; c <= right; ++c) {
+        Column &column = m_columns[c];
+
+        for (int i = 0; i < count; ++i) {
+            int gr = i % grid.rowCount();
+            int columns = grid.columnCount(gr);
+            int gc = columns > 0 ? (c - left) % columns : -1;
+
+            int id = _rowId(rows ? rows[i] : top + i);
+            const Cell * cell = _cell(column, id);
+            if (cell) {
+                column.garbage += cell->length;
+            }
+
+            if (gc < 0)
+                _store(column, id, nullptr, 0);
+            else
+                _store(column, id, grid.data(gr, gc), grid.length(gr, gc));
+        }
+
+        _maybeCompact(column);
+    }
+}
+
+void CellStore::write(CSV::Writer &writer) const
+{
+    if (_canWriteIncremental()) {
+        _writeIncremental(writer);
+        return;
+    }
+
+    for (int c = 0; c < m_columns.size(); ++c) {
+        writer.writeField(m_columns[c].title);
+    }
+    writer.endRow();
+
+    QVector<CSV::Slice> fields;
+    QByteArray unescaped;
+
+    for (int r = 0; r < m_rowCount; ++r) {
+        _writeRow(writer, _rowId(r), fields, unescaped);
+    }
+}
+
+void CellStore::findInRows(int begin, int end, const QByteArray &raw,
+                           const std::function<bool (const QString &)> &match,
+                           QVector<QPoint> &hits) const
+{
+    QByteArrayMatcher matcher(raw);
+    QVector<CSV::Slice> fields;
+
+    // a quote of the file is doubled inside a field, the raw bytes would
+    // not be found
+    bool prefilter = !raw.isEmpty() && !(m_source && raw.contains(m_source->dialect().quote));
+
+    for (int r = begin; r < end; ++r) {
+        int id = _rowId(r);
+
+        // a file row without the raw bytes cannot match, only its edited
+        // cells are left to look at
+        bool decode = id >= 0;
+        if (decode && prefilter) {
+            qint64 rowBegin = m_source->rowBegin(id + 1);
+            decode = matcher.indexIn(m_source->data() + rowBegin,
+                                     m_source->rowEnd(id + 1) - rowBegin) >= 0;
+        }
+
+        fields.resize(0);
+        if (decode) {
+            m_source->rowFields(id + 1, fields);
+        }
+
+        for (int c = 0; c < m_columns.size(); ++c) {
+            const char * data;
+            int length;
+            char buffer[FORMAT_BUFFER];
+
+            QString text;
+            if (_value(m_columns[c], id, data, length, buffer)) {
+                text = QString::fromUtf8(data, length);
+            } else if (id >= 0 && !decode) {
+                continue;
+            } else if (c < m_sourceColumns && c < fields.size()) {
+                const CSV::Slice &slice = fields[c];
+                if (slice.escaped)
+                    text = CSV::unescape(slice.begin, slice.end, m_source->dialect().quote);
+                else
+                    text = QString::fromUtf8(slice.begin, slice.end - slice.begin);
+            }
+
+            if (match(text)) {
+                hits.append(QPoint(c, r));
+            }
+        }
+    }
+}
+
+void CellStore::visitCells(int begin, int end, const QVector<int> &columns,
+                           const std::function<void (int, int, const char *, int)> &visit) const
+{
+    QVector<CSV::Slice> fields;
+    QByteArray unescaped;
+
+    for (int r = begin; r < end; ++r) {
+        int id = _rowId(r);
+        bool decoded = false;
+
+        for (int i = 0; i < columns.size(); ++i) {
+            int c = columns[i];
+            const char * data;
+            int length;
+            char buffer[FORMAT_BUFFER];
+
+            if (_value(m_columns[c], id, data, length, buffer)) {
+                visit(r, i, data, length);
+                continue;
+            }
+            if (id < 0 || c >= m_sourceColumns) {
+                visit(r, i, nullptr, 0);
+                continue;
+            }
+
+            if (!decoded) {
+                m_source->rowFields(id + 1, fields);
+                decoded = true;
+            }
+            if (c >= fields.size()) {
+                visit(r, i, nullptr, 0);
+            } else if (fields[c].escaped) {
+                CSV::unescape(fields[c].begin, fields[c].end, unescaped, m_source->dialect().quote);
+                visit(r, i, unescaped.constData(), unescaped.size());
+            } else {
+                visit(r, i, fields[c].begin, fields[c].end - fields[c].begin);
+            }
+        }
+    }
+}
+
+bool CellStore::_canWriteIncremental() const
+{
+    // only when the file still has the same shape: no rows or columns
+    // added, removed or moved, and the header untouched
+    if (!m_source || m_addedRows > 0 || !m_order.isEmpty() || m_rowCount != m_sourceRows
+            || m_columns.size() != m_sourceColumns) {
+        return false;
+    }
+
+    QStringList header = m_source->row(0);
+    for (int c = 0; c < m_columns.size(); ++c) {
+        if (m_columns[c].title != header.value(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CellStore::_writeIncremental(CSV::Writer &writer) const
+{
+    QVector<int> dirty;
+    for (int c = 0; c < m_columns.size(); ++c) {
+        dirty += m_columns[c].overrides.keys().toVector();
+    }
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    // unchanged rows are copied from the original byte for byte, only
+    // edited rows are encoded again; file row r + 1 holds row r. The
+    // byte order mark is left to the writer
+    QVector<CSV::Slice> fields;
+    QByteArray unescaped;
+    qint64 copied = m_source->dialect().bom;
+
+    for (int i = 0; i < dirty.size(); ++i) {
+        int r = dirty[i];
+        if (!writer.flush() || !m_source->copy(copied, m_source->rowBegin(r + 1), writer.device())) {
+            writer.setError();
+            return;
+        }
+
+        _writeRow(writer, r, fields, unescaped);
+        copied = m_source->rowEnd(r + 1);
+    }
+
+    if (!writer.flush() || !m_source->copy(copied, m_source->rowEnd(m_sourceRows), writer.device())) {
+        writer.setError();
+    }
+}
+
+void CellStore::writeRows(CSV::Writer &writer, const QVector<int> &rows,
+                          const QVector<int> &columns) const
+{
+    QVector<CSV::Slice> fields;
+    QByteArray unescaped;
+
+    foreach (int r, rows) {
+        _writeRow(writer, _rowId(r), fields, unescaped, &columns);
+    }
+}
+
+void CellStore::_writeRow(CSV::Writer &writer, int id, QVector<CSV::Slice> &fields,
+                          QByteArray &unescaped, const QVector<int> * columns) const
+{
+    // cells go straight from the column buffers or the mapped file to the
+    // writer, only quoted fields of the file are decoded first
+    if (id >= 0) {
+        m_source->rowFields(id + 1, fields);
+    } else {
+        fields.resize(0);
+    }
+
+    int count = columns ? columns->size() : m_columns.size();
+    for (int i = 0; i < count; ++i) {
+        int c = columns ? columns->at(i) : i;
+        const char * data;
+        int length;
+        char buffer[FORMAT_BUFFER];
+
+        if (_value(m_columns[c], id, data, length, buffer)) {
+            writer.writeField(data, length);
+        } else if (c < m_sourceColumns && c < fields.size()) {
+            const CSV::Slice &slice = fields[c];
+            if (slice.escaped) {
+                CSV::unescape(slice.begin, slice.end, unescaped, m_source->dialect().quote);
+                writer.writeField(unescaped.constData(), unescaped.size());
+            } else {
+                writer.writeField(slice.begin, slice.end - slice.begin);
+            }
+        } else {
+            writer.writeField(nullptr, 0);
+        }
+    }
+    writer.endRow();
+}
+
+int CellStore::_rowId(int r) const
+{
+    if (!m_order.isEmpty()) {
+        return m_order.at(r);
+    }
+    return r < m_sourceRows ? r : m_sourceRows - 1 - r;
+}
+
+void CellStore::_buildOrder()
+{
+    m_order.resize(m_rowCount);
+    for (int r = 0; r < m_rowCount; ++r) {
+        m_order[r] = r < m_sourceRows ? r : m_sourceRows - 1 - r;
+    }
+}
+
+const CellStore::Cell * CellStore::_cell(const Column &column, int id) const
+{
+    if (id < 0) {
+        return column.type == Text ? &column.cells.at(-1 - id) : nullptr;
+    }
+
+    QHash<int, Cell>::const_iterator it = column.overrides.constFind(id);
+    return it == column.overrides.constEnd() ? nullptr : &it.value();
+}
+
+CellStore::Cell & CellStore::_cellRef(Column &column, int id)
+{
+    if (id < 0) {
+        return column.cells[-1 - id];
+    }
+    return column.overrides[id];
+}
+
+QString CellStore::_sourceText(int id, int c) const
+{
+    if (c >= m_sourceColumns) {
+        return QString();
+    }
+
+    // skip the header row of the file
+    int r = id + 1;
+    int block = r / CsvFile::BLOCK_ROWS;
+    int first = block * CsvFile::BLOCK_ROWS;
+
+    // the last block may have grown since it was decoded
+    QVector<QStringList> * rows = m_sourceBlocks.object(block);
+    if (!rows || r - first >= rows->size()) {
+        int last = qMin(first + int(CsvFile::BLOCK_ROWS), m_source->rowCount());
+        rows = new QVector<QStringList>();
+        rows->reserve(last - first);
+        for (int i = first; i < last; ++i) {
+            rows->append(m_source->row(i));
+        }
+        m_sourceBlocks.insert(block, rows, rows->size());
+    }
+    return rows->at(r - first).value(c);
+}
+
+void CellStore::_store(Column &column, int id, const QByteArray &utf8)
+{
+    _store(column, id, utf8.constData(), utf8.size());
+}
+
+void CellStore::_store(Column &column, int id, const char * data, int length)
+{
+    if (length > column.widest) {
+        column.widest = length;
+        column.widestValue = QByteArray(data, length);
+    }
+
+    if (column.type == Dictionary && id < 0) {
+        int code = _intern(column, data, length, MAX_WORDS);
+        if (code >= 0) {
+            column.codes[-1 - id] = quint16(code);
+            return;
+        }
+        _untype(column);
+        column.garbage += column.cells[-1 - id].length;
+    } else if (column.type != Text && id < 0) {
+        qint64 &value = column.values[-1 - id];
+        if (length == 0) {
+            value = EMPTY_VALUE;
+            return;
+        }
+        if (parseValue(column.type, column.format, data, length, value)) {
+            return;
+        }
+        _untype(column);
+        column.garbage += column.cells[-1 - id].length;
+    }
+
+    Cell &cell = _cellRef(column, id);
+    cell.offset = column.bytes.size();
+    cell.length = length;
+    column.bytes.append(data, length);
+}
+
+bool CellStore::_value(const Column &column, int id, const char *&data, int &length,
+                       char * buffer) const
+{
+    if (column.type == Dictionary && id < 0) {
+        const QByteArray &word = column.words.at(column.codes.at(-1 - id));
+        data = word.constData();
+        length = word.size();
+        return true;
+    }
+    if (column.type != Text && id < 0) {
+        qint64 value = column.values.at(-1 - id);
+        data = buffer;
+        length = value == EMPTY_VALUE ? 0 : formatValue(column.type, column.format, value, buffer);
+        return true;
+    }
+
+    const Cell * cell = _cell(column, id);
+    if (!cell) {
+        return false;
+    }
+    data = column.bytes.constData() + cell->offset;
+    length = cell->length;
+    return true;
+}
+
+void CellStore::_inferType(Column &column)
+{
+    if (!_inferValues(column) && !_encode(column)) {
+        return;
+    }
+
+    // only edits of the file are left in bytes
+    column.cells = QVector<Cell>();
+    _compact(column);
+    column.bytes.squeeze();
+}
+
+bool CellStore::_inferValues(Column &column)
+{
+    Type type = Text;
+    int format = 0;
+    QVector<qint64> values(column.cells.size());
+
+    for (int i = 0; i < column.cells.size(); ++i) {
+        const Cell &cell = column.cells[i];
+        const char * data = column.bytes.constData() + cell.offset;
+        if (cell.length == 0) {
+            values[i] = EMPTY_VALUE;
+            continue;
+        }
+
+        // the first value decides, all others have to fit
+        if (type == Text && !classify(data, cell.length, type, format)) {
+            return false;
+        }
+        if (!parseValue(type, format, data, cell.length, values[i])) {
+            return false;
+        }
+    }
+
+    // nothing but empty cells
+    if (type == Text) {
+        return false;
+    }
+
+    column.type = type;
+    column.format = format;
+    column.values = values;
+    return true;
+}
+
+bool CellStore::_encode(Column &column)
+{
+    QVector<quint16> codes(column.cells.size());
+    column.words.append(QByteArray());
+    column.lookup.insert(QByteArray(), 0);
+
+    bool fits = true;
+    for (int i = 0; fits && i < column.cells.size(); ++i) {
+        const Cell &cell = column.cells[i];
+        int code = _intern(column, column.bytes.constData() + cell.offset, cell.length,
+                           ENCODE_WORDS);
+        fits = code >= 0;
+        codes[i] = quint16(qMax(code, 0));
+    }
+
+    if (!fits || column.words.size() * ENCODE_USES > column.cells.size()) {
+        column.words.clear();
+        column.lookup.clear();
+        column.lookups = 0;
+        column.hits = 0;
+        return false;
+    }
+
+    column.type = Dictionary;
+    column.codes = codes;
+    return true;
+}
+
+int CellStore::_intern(Column &column, const char * data, int length, int limit)
+{
+    column.lookups += 1;
+
+    QHash<QByteArray, int>::const_iterator it =
+            column.lookup.constFind(QByteArray::fromRawData(data, length));
+    if (it != column.lookup.constEnd()) {
+        column.hits += 1;
+        return it.value();
+    }
+    if (column.words.size() >= limit) {
+        return -1;
+    }
+
+    int code = column.words.size();
+    column.words.append(QByteArray(data, length));
+    column.lookup.insert(column.words.last(), code);
+    return code;
+}
+
+void CellStore::_untype(Column &column)
+{
+    if (column.type == Dictionary) {
+        column.cells.resize(column.codes.size());
+        for (int i = 0; i < column.codes.size(); ++i) {
+            const QByteArray &word = column.words.at(column.codes[i]);
+            Cell &cell = column.cells[i];
+            cell.offset = column.bytes.size();
+            cell.length = word.size();
+            column.bytes.append(word);
+        }
+
+        column.type = Text;
+        column.codes = QVector<quint16>();
+        column.words = QVector<QByteArray>();
+        column.lookup = QHash<QByteArray, int>();
+        return;
+    }
+
+    column.cells.resize(column.values.size());
+
+    char buffer[FORMAT_BUFFER];
+    for (int i = 0; i < column.values.size(); ++i) {
+        qint64 value = column.values[i];
+        int length = value == EMPTY_VALUE ? 0 : formatValue(column.type, column.format, value, buffer);
+
+        Cell &cell = column.cells[i];
+        cell.offset = column.bytes.size();
+        cell.length = length;
+        column.bytes.append(buffer, length);
+    }
+
+    column.type = Text;
+    column.format = 0;
+    column.values = QVector<qint64>();
+}
+
+void CellStore::_maybeCompact(Column &column)
+{
+    if (column.garbage > COMPACT_THRESHOLD && column.garbage > column.bytes.size() / 2) {
+        _compact(column);
+    }
+}
+
+void CellStore::_compact(Column &column)
+{
+    QByteArray bytes;
+    bytes.reserve(column.bytes.size() - column.garbage);
+
+    for (int r = 0; r < column.cells.size(); ++r) {
+        Cell &cell = column.cells[r];
+        int offset = bytes.size();
+        bytes.append(column.bytes.constData() + cell.offset, cell.length);
+        cell.offset = offset;
+    }
+
+    for (QHash<int, Cell>::iterator it = column.overrides.begin(); it != column.overrides.end(); ++it) {
+        Cell &cell = it.value();
+        int offset = bytes.size();
+        bytes.append(column.bytes.constData() + cell.offset, cell.length);
+        cell.offset = offset;
+    }
+
+    column.bytes = bytes;
+    column.garbage = 0;
+}
@@ -0,0 +1,250 @@
+#ifndef CELLSTORE_H
+#define CELLSTORE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QPoint>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+
+class CsvFile;
+namespace CSV { struct LineEndings; struct Slice; class Writer; }
+
+// A grid of utf-8 values packed into one buffer. Rows may differ in length.
+class CellGrid
+{
+public:
+    CellGrid();
+    explicit CellGrid(const QList<QStringList> &rows);
+
+    void reserve(int bytes);
+    void addRow();
+    void addCell(const char * data, int length);
+    void addCell(const QString &text);
+
+    int rowCount() const;
+    int columnCount(int r) const;
+    const char * data(int r, int c) const;
+    int length(int r, int c) const;
+
+    qint64 size() const;
+
+private:
+    QByteArray m_bytes;
+    // end of every cell in m_bytes
+    QVector<quint32> m_ends;
+    // index of the first cell of every row
+    QVector<int> m_rows;
+};
+
+// Columnar cell storage. Every column keeps its cells as UTF-8 bytes in one
+// contiguous buffer plus an (offset, length) pair per row, so memory follows
+// the size of the data instead of the number of cells. QStrings are only
+// created when a cell is actually read.
+//
+// A store can also be attached to a mapped CsvFile. Rows of the file are then
+// decoded on demand and only edited cells are kept in the column buffers.
+//
+// Every row has an id: rows of the file are 0, 1, 2, ..., rows added later
+// are -1, -2, -3, .... Inserting or removing rows only moves ids around, so
+// undo can put back the very same rows without copying any cells.
+//
+// Columns of added rows that only hold integers, decimals with a fixed
+// number of places or timestamps of one format can be kept as packed
+// 64-bit values instead, see inferTypes(). Values are only taken when
+// they format back to exactly the same text, and the column turns back
+// into text as soon as an edit does not fit.
+//
+// Other columns with few distinct values, such as a status or a region,
+// keep every distinct value once and a 16-bit code per row.
+class CellStore
+{
+public:
+    enum Type {
+        Text,
+        Integer,
+        Decimal,
+        Timestamp,
+        Dictionary,
+    };
+
+    struct ColumnStats
+    {
+        Type type;
+        // distinct values of a dictionary column
+        int distinct;
+        // values looked up in the dictionary, and how many were in it
+        qint64 lookups;
+        qint64 hits;
+        // memory held for added rows and edits
+        qint64 bytes;
+    };
+
+    CellStore();
+
+    void clear();
+
+    // takes the first row as the header, every column buffer is allocated
+    // once at its final size. Without `typed` every column keeps its text,
+    // for stores that are only read once
+    void load(const QVector<CellGrid> &grids, bool typed = true);
+    void attach(QSharedPointer<CsvFile> file);
+    void appendSourceRows(const QVector<qint64> &ends, const CSV::LineEndings &endings);
+    void materialize();
+    bool isAttached() const;
+
+    int columnCount() const;
+    int rowCount() const;
+
+    QString text(int r, int c) const;
+    void setText(int r, int c, const QString &text);
+
+    QString header(int c) const;
+    void setHeader(int c, const QString &title);
+
+    void inferTypes();
+    Type columnType(int c) const;
+    // the value of a typed cell, timestamps in seconds since the epoch;
+    // false when the cell is empty or the column holds text
+    bool number(int r, int c, double &value) const;
+    ColumnStats columnStats(int c) const;
+
+    // the longest value written to the column since it was loaded, rows
+    // of an attached file are not looked at
+    QString widestText(int c) const;
+
+    int addColumn(const QString &title);
+    void removeLastColumn();
+
+    // new empty rows, not shown before insertRows()
+    QVector<int> newRows(int count);
+    void insertRows(int at, const QVector<int> &rows);
+    QVector<int> removeRows(int at, int count);
+
+    // ids of the rows in view order
+    QVector<int> rowOrder() const;
+    void setRowOrder(const QVector<int> &order);
+
+    // the grid is repeated over the range when it is smaller
+    void readRange(int top, int left, int bottom, int right, CellGrid &grid) const;
+    void writeRange(int top, int left, int bottom, int right, const CellGrid &grid);
+    // the same over the given rows only
+    void readRows(const QVector<int> &rows, int left, int right, CellGrid &grid) const;
+    void writeRows(const QVector<int> &rows, int left, int right, const CellGrid &grid);
+
+    void write(CSV::Writer &writer) const;
+    // the given rows with only the given columns, without a header
+    void writeRows(CSV::Writer &writer, const QVector<int> &rows, const QVector<int> &columns) const;
+
+    // Appends the cells of rows [begin, end) that match, as (column, row).
+    // Unchanged rows of the file that do not hold the `raw` bytes are not
+    // decoded at all. Safe to run on several threads at once.
+    void findInRows(int begin, int end, const QByteArray &raw,
+                    const std::function<bool (const QString &)> &match,
+                    QVector<QPoint> &hits) const;
+
+    // Calls visit(r, i, data, length) with the utf-8 bytes of cell
+    // columns[i] of every row in [begin, end). The bytes are only valid
+    // during the call. Safe to run on several threads at once.
+    void visitCells(int begin, int end, const QVector<int> &columns,
+                    const std::function<void (int, int, const char *, int)> &visit) const;
+
+private:
+    struct Cell
+    {
+        Cell() : offset(0), length(0) {}
+
+        quint32 offset;
+        quint32 length;
+    };
+
+    struct Column
+    {
+        Column()
+            : type(Text), format(0), lookups(0), hits(0), garbage(0), widest(0)
+        {
+        }
+
+        QString title;
+
+        // typed columns keep added rows in values instead of cells, the
+        // format is the number of decimal places or the timestamp layout
+        Type type;
+        int format;
+        QVector<qint64> values;
+
+        // dictionary columns keep added rows in codes, code 0 is the
+        // empty value
+        QVector<quint16> codes;
+        QVector<QByteArray> words;
+        QHash<QByteArray, int> lookup;
+        qint64 lookups;
+        qint64 hits;
+
+        QByteArray bytes;
+        // added rows, row id -1 - i is cells[i]
+        QVector<Cell> cells;
+        // edited rows of the attached file
+        QHash<int, Cell> overrides;
+        int garbage;
+        // the longest value stored so far, kept when its cell changes or
+        // its row goes, a column only ever gets wider
+        int widest;
+        QByteArray widestValue;
+    };
+
+    bool _canWriteIncremental() const;
+    void _writeIncremental(CSV::Writer &writer) const;
+    void _writeRow(CSV::Writer &writer, int id, QVector<CSV::Slice> &fields,
+                   QByteArray &unescaped, const QVector<int> * columns = nullptr) const;
+
+    void _readRows(const int * rows, int top, int count, int left, int right,
+                   CellGrid &grid) const;
+    void _writeRows(const int * rows, int top, int count, int left, int right,
+                    const CellGrid &grid);
+
+    enum { FORMAT_BUFFER = 32 };
+
+    bool _value(const Column &column, int id, const char *&data, int &length,
+                char * buffer) const;
+    void _inferType(Column &column);
+    bool _inferValues(Column &column);
+    bool _encode(Column &column);
+    int _intern(Column &column, const char * data, int length, int limit);
+    void _untype(Column &column);
+
+    int _rowId(int r) const;
+    QString _text(int id, int c) const;
+    void _buildOrder();
+
+    const Cell * _cell(const Column &column, int id) const;
+    Cell & _cellRef(Column &column, int id);
+    QString _sourceText(int id, int c) const;
+    void _store(Column &column, int id, const QByteArray &utf8);
+    void _store(Column &column, int id, const char * data, int length);
+    void _maybeCompact(Column &column);
+    void _compact(Column &column);
+
+private:
+    QVector<Column> m_columns;
+    int m_rowCount;
+    int m_addedRows;
+
+    // id of every row, empty while rows are in id order: the file first,
+    // then every added row
+    QVector<int> m_order;
+
+    QSharedPointer<CsvFile> m_source;
+    int m_sourceRows;
+    int m_sourceColumns;
+
+    // the view reads a row cell by cell, keep the blocks of rows decoded
+    // last, with the number of rows as their cost
+    mutable QCache<int, QVector<QStringList> > m_sourceBlocks;
+};
+
+#endif // CELLSTORE_H
@@ -0,0 +1,364 @@
+#include "commandcenter.h"
+#include "tablemodel.h"
+
+#include <QTableView>
+
+#include <climits>
+
+// edits merged into one step at most
+static const int MERGE_EDITS = 256;
+
+////////////////////////////////////////////////////////////////////////////////
+/// Commands
+
+SetCellsCommand::SetCellsCommand()
+    : m_top(INT_MAX), m_left(INT_MAX), m_bottom(-1), m_right(-1)
+{
+}
+
+void SetCellsCommand::add(int r, int c, const QString &oldText, const QString &newText)
+{
+    m_top = qMin(m_top, r);
+    m_left = qMin(m_left, c);
+    m_bottom = qMax(m_bottom, r);
+    m_right = qMax(m_right, c);
+
+    Edit edit;
+    edit.row = r;
+    edit.col = c;
+    edit.oldBegin = m_bytes.size();
+    m_bytes.append(oldText.toUtf8());
+    edit.newBegin = m_bytes.size();
+    m_bytes.append(newText.toUtf8());
+    edit.newEnd = m_bytes.size();
+    m_edits.append(edit);
+}
+
+int SetCellsCommand::count() const
+{
+    return m_edits.size();
+}
+
+bool SetCellsCommand::adjoins(int r, int c) const
+{
+    if (m_edits.isEmpty())
+        return false;
+
+    const Edit &last = m_edits.last();
+    return (last.col == c && qAbs(last.row - r) == 1)
+            || (last.row == r && qAbs(last.col - c) == 1);
+}
+
+void SetCellsCommand::redo(TableModel *model, CommandCenter *)
+{
+    const char * bytes = m_bytes.constData();
+    for (int i = 0; i < m_edits.size(); ++i) {
+        const Edit &e = m_edits[i];
+        model->writeCellText(e.row, e.col,
+                QString::fromUtf8(bytes + e.newBegin, e.newEnd - e.newBegin));
+    }
+    model->cellsChanged(m_top, m_left, m_bottom, m_right);
+}
+
+void SetCellsCommand::undo(TableModel *model, CommandCenter *)
+{
+    const char * bytes = m_bytes.constData();
+    for (int i = m_edits.size() - 1; i >= 0; --i) {
+        const Edit &e = m_edits[i];
+        model->writeCellText(e.row, e.col,
+                QString::fromUtf8(bytes + e.oldBegin, e.newBegin - e.oldBegin));
+    }
+    model->cellsChanged(m_top, m_left, m_bottom, m_right);
+}
+
+qint64 SetCellsCommand::size() const
+{
+    return sizeof(*this) + m_edits.capacity() * sizeof(Edit) + m_bytes.capacity();
+}
+
+void SetRangeCommand::redo(TableModel *model, CommandCenter *)
+{
+    if (!m_saved) {
+        if (m_rows.isEmpty())
+            model->store().readRange(m_top, m_left, m_bottom, m_right, m_old);
+        else
+            model->store().readRows(m_rows, m_left, m_right, m_old);
+        m_saved = true;
+    }
+
+    if (m_rows.isEmpty())
+        model->setRange(m_top, m_left, m_bottom, m_right, m_new);
+    else
+        model->setRows(m_rows, m_left, m_right, m_new);
+}
+
+void SetRangeCommand::undo(TableModel *model, CommandCenter *)
+{
+    if (m_rows.isEmpty())
+        model->setRange(m_top, m_left, m_bottom, m_right, m_old);
+    else
+        model->setRows(m_rows, m_left, m_right, m_old);
+}
+
+qint64 SetRangeCommand::size() const
+{
+    return sizeof(*this) + m_rows.capacity() * sizeof(int) + m_new.size() + m_old.size();
+}
+
+void InsertRowsCommand::redo(TableModel *model, CommandCenter *)
+{
+    if (m_rows.isEmpty()) {
+        m_rows = model->store().newRows(m_count);
+    }
+    model->insertRowIds(m_at, m_rows);
+}
+
+void InsertRowsCommand::undo(TableModel *model, CommandCenter *)
+{
+    model->removeRowIds(m_at, m_count);
+}
+
+qint64 InsertRowsCommand::size() const
+{
+    return sizeof(*this) + m_rows.capacity() * sizeof(int);
+}
+
+void RemoveRowsCommand::redo(TableModel *model, CommandCenter *)
+{
+    m_rows = model->removeRowIds(m_at, m_count);
+}
+
+void RemoveRowsCommand::undo(TableModel *model, CommandCenter *)
+{
+    model->insertRowIds(m_at, m_rows);
+}
+
+qint64 RemoveRowsCommand::size() const
+{
+    return sizeof(*this) + m_rows.capacity() * sizeof(int);
+}
+
+void SortRowsCommand::redo(TableModel *model, CommandCenter *)
+{
+    if (m_newOrder.isEmpty()) {
+        m_oldOrder = model->store().rowOrder();
+        QVector<int> rows = Sorter(m_keys).sort(model->store());
+
+        m_newOrder.resize(rows.size());
+        for (int i = 0; i < rows.size(); ++i) {
+            m_newOrder[i] = m_oldOrder[rows[i]];
+        }
+    }
+    model->setRowOrder(m_newOrder);
+}
+
+void SortRowsCommand::undo(TableModel *model, CommandCenter *)
+{
+    model->setRowOrder(m_oldOrder);
+}
+
+qint64 SortRowsCommand::size() const
+{
+    return sizeof(*this) + (m_oldOrder.capacity() + m_newOrder.capacity()) * sizeof(int)
+            + m_keys.capacity() * sizeof(SortKey);
+}
+
+void AddColumnCommand::redo(TableModel *model, CommandCenter *)
+{
+    model->appendColumn(m_title);
+}
+
+void AddColumnCommand::undo(TableModel *model, CommandCenter *)
+{
+    model->removeLastColumn();
+}
+
+qint64 AddColumnCommand::size() const
+{
+    return sizeof(*this) + m_title.size() * sizeof(QChar);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CommandCenter
+
+CommandCenter::CommandCenter(QObject * parent, QTableView * tv, TableModel * model)
+    : QObject(parent), m_tv(tv), m_model(model), m_curStatus(0)
+    , m_edits(nullptr), m_size(0), m_sizeLimit(0), m_stepLimit(0)
+{
+}
+
+void CommandCenter::setLimits(qint64 bytes, int steps)
+{
+    m_sizeLimit = bytes;
+    m_stepLimit = steps;
+    _trim();
+}
+
+void CommandCenter::begin(const QString &name)
+{
+    if (m_transStack.empty()) {
+        while (m_history.length() > m_curStatus) {
+            m_size -= m_history.last().size;
+            m_history.pop_back();
+        }
+
+        m_history.push_back(CommandGroup());
+        m_history.last().name = name;
+        m_history.last().prevSelection = m_tv->selectionModel()->selection();
+        m_history.last().size = 0;
+        m_history.last().mergeable = false;
+        m_edits = nullptr;
+    }
+
+    m_transStack.push(name);
+}
+
+void CommandCenter::addCommand(Command * cmd)
+{
+    if (!m_transStack.empty()) {
+        m_history.last().append(QSharedPointer<Command>(cmd));
+        m_edits = nullptr;
+        cmd->redo(m_model, this);
+    } else {
+        begin(QString());
+        addCommand(cmd);
+        commit();
+    }
+}
+
+void CommandCenter::addEdit(int r, int c, const QString &oldText, const QString &newText)
+{
+    if (!m_transStack.empty()) {
+        // consecutive edits go into the same packed command
+        if (!m_edits) {
+            m_edits = new SetCellsCommand;
+            m_history.last().append(QSharedPointer<Command>(m_edits));
+        }
+        m_edits->add(r, c, oldText, newText);
+        m_model->setCellText(r, c, newText);
+    } else if (_canMerge(r, c)) {
+        CommandGroup & g = m_history.last();
+        SetCellsCommand * edits = static_cast<SetCellsCommand *>(g.first().data());
+        edits->add(r, c, oldText, newText);
+        m_model->setCellText(r, c, newText);
+
+        g.postSelection = m_tv->selectionModel()->selection();
+        m_size -= g.size;
+        g.size = sizeof(CommandGroup) + edits->size();
+        m_size += g.size;
+        _trim();
+
+        emit commited();
+    } else {
+        begin(QString());
+        addEdit(r, c, oldText, newText);
+        commit();
+        m_history.last().mergeable = true;
+    }
+}
+
+void CommandCenter::commit()
+{
+    if (m_transStack.empty())
+        return;
+
+    m_transStack.pop();
+
+    if (m_transStack.empty()) {
+        m_edits = nullptr;
+
+        CommandGroup & g = m_history.last();
+        if (g.length() > 0) {
+            m_curStatus += 1;
+            g.postSelection = m_tv->selectionModel()->selection();
+
+            g.size = sizeof(CommandGroup);
+            for (int i = 0; i < g.length(); ++i) {
+                g.size += g[i]->size();
+            }
+            m_size += g.size;
+
+            _trim();
+        }
+        else
+            m_history.pop_back();
+
+        emit commited();
+    }
+}
+
+void CommandCenter::undo()
+{
+    if (m_curStatus == 0)
+        return;
+
+    CommandGroup & g = m_history[m_curStatus - 1];
+    for (int i = g.length() - 1; i >= 0; --i) {
+        g[i]->undo(m_model, this);
+    }
+
+    m_tv->selectionModel()->select(g.prevSelection, QItemSelectionModel::ClearAndSelect);
+
+    m_curStatus -= 1;
+
+    emit undone();
+}
+
+void CommandCenter::redo()
+{
+    if (m_curStatus >= m_history.length())
+        return;
+
+    CommandGroup & g = m_history[m_curStatus];
+    for (int i = 0; i < g.length(); ++i) {
+        g[i]->redo(m_model, this);
+    }
+
+    m_tv->selectionModel()->select(g.postSelection, QItemSelectionModel::ClearAndSelect);
+
+    m_curStatus += 1;
+
+    emit redone();
+}
+
+void CommandCenter::clear()
+{
+    m_history.clear();
+    m_curStatus = 0;
+    m_transStack.clear();
+    m_edits = nullptr;
+    m_size = 0;
+}
+
+int CommandCenter::length()
+{
+    return m_history.length();
+}
+
+bool CommandCenter::_canMerge(int r, int c) const
+{
+    // only into the newest step, and not once it was undone
+    if (m_curStatus == 0 || m_curStatus != m_history.length() || !m_history.last().mergeable)
+        return false;
+
+    const SetCellsCommand * edits = static_cast<const SetCellsCommand *>(m_history.last().first().data());
+    return edits->count() < MERGE_EDITS && edits->adjoins(r, c);
+}
+
+void CommandCenter::_trim()
+{
+    // never inside a transaction, and the newest step always stays
+    if (!m_transStack.empty())
+        return;
+
+    while (m_curStatus > 1) {
+        bool overSize = m_sizeLimit > 0 && m_size > m_sizeLimit;
+        bool overSteps = m_stepLimit > 0 && m_history.length() > m_stepLimit;
+        if (!overSize && !overSteps)
+            break;
+
+        m_size -= m_history.first().size;
+        m_history.pop_front();
+        m_curStatus -= 1;
+    }
+}
@@ -0,0 +1,228 @@
+#ifndef COMMANDCENTER_H
+#define COMMANDCENTER_H
+
+#include <QObject>
+#include <QItemSelection>
+#include <QSharedPointer>
+#include <QStack>
+#include <QVector>
+
+#include "cellstore.h"
+#include "sorter.h"
+
+class QTableView;
+class TableModel;
+class CommandCenter;
+
+class Command {
+public:
+    virtual void redo(TableModel * model, CommandCenter * cc) = 0;
+    virtual void undo(TableModel * model, CommandCenter * cc) = 0;
+    // memory held by the command, counted against the history budget
+    virtual qint64 size() const = 0;
+    virtual ~Command() {}
+};
+
+// All cell edits of a transaction in one command. Old and new values are
+// packed into a single utf-8 buffer, so a paste over half a million cells
+// is one object instead of half a million.
+class SetCellsCommand : public Command {
+public:
+    SetCellsCommand();
+
+    void add(int r, int c, const QString &oldText, const QString &newText);
+    int count() const;
+    // next to the last edit, in the same row or column
+    bool adjoins(int r, int c) const;
+
+    void redo(TableModel *model, CommandCenter *);
+    void undo(TableModel *model, CommandCenter *);
+    qint64 size() const;
+
+private:
+    struct Edit
+    {
+        int row;
+        int col;
+        // old value is [oldBegin, newBegin), new value [newBegin, newEnd)
+        quint32 oldBegin;
+        quint32 newBegin;
+        quint32 newEnd;
+    };
+
+    QVector<Edit> m_edits;
+    QByteArray m_bytes;
+
+    // bounding box of the edits, views are told about it once
+    int m_top;
+    int m_left;
+    int m_bottom;
+    int m_right;
+};
+
+// Writes a grid over a rectangle, repeating it when the rectangle is
+// larger. The old values are read on the first redo, the store is written
+// in one pass and views are told once. Instead of top to bottom, the
+// rectangle may also span a list of rows, as picked by a filter.
+class SetRangeCommand : public Command {
+public:
+    SetRangeCommand(int top, int left, int bottom, int right, const CellGrid &grid)
+        : m_top(top), m_left(left), m_bottom(bottom), m_right(right)
+        , m_new(grid), m_saved(false)
+    {
+    }
+
+    SetRangeCommand(const QVector<int> &rows, int left, int right, const CellGrid &grid)
+        : m_top(0), m_left(left), m_bottom(-1), m_right(right)
+        , m_rows(rows), m_new(grid), m_saved(false)
+    {
+    }
+
+    void redo(TableModel *model, CommandCenter *);
+    void undo(TableModel *model, CommandCenter *);
+    qint64 size() const;
+
+private:
+    int m_top;
+    int m_left;
+    int m_bottom;
+    int m_right;
+    QVector<int> m_rows;
+
+    CellGrid m_new;
+    CellGrid m_old;
+    bool m_saved;
+};
+
+// Row commands keep the ids of the rows they move, the cells stay in the
+// store while the rows are hidden.
+class InsertRowsCommand : public Command {
+public:
+    InsertRowsCommand(int at, int count)
+        : m_at(at), m_count(count)
+    {
+    }
+
+    void redo(TableModel *model, CommandCenter *);
+    void undo(TableModel *model, CommandCenter *);
+    qint64 size() const;
+
+private:
+    int m_at;
+    int m_count;
+    QVector<int> m_rows;
+};
+
+class RemoveRowsCommand : public Command {
+public:
+    RemoveRowsCommand(int at, int count)
+        : m_at(at), m_count(count)
+    {
+    }
+
+    void redo(TableModel *model, CommandCenter *);
+    void undo(TableModel *model, CommandCenter *);
+    qint64 size() const;
+
+private:
+    int m_at;
+    int m_count;
+    QVector<int> m_rows;
+};
+
+// Sorting only reorders row ids, undo puts back the order from before.
+class SortRowsCommand : public Command {
+public:
+    SortRowsCommand(const QVector<SortKey> &keys)
+        : m_keys(keys)
+    {
+    }
+
+    void redo(TableModel *model, CommandCenter *);
+    void undo(TableModel *model, CommandCenter *);
+    qint64 size() const;
+
+private:
+    QVector<SortKey> m_keys;
+    QVector<int> m_oldOrder;
+    QVector<int> m_newOrder;
+};
+
+class AddColumnCommand : public Command {
+public:
+    AddColumnCommand(const QString &title)
+        : m_title(title)
+    {
+    }
+
+    ~AddColumnCommand() {
+    }
+
+    void redo(TableModel *model, CommandCenter *);
+    void undo(TableModel *model, CommandCenter *);
+    qint64 size() const;
+
+private:
+    QString m_title;
+};
+
+struct CommandGroup : public QList<QSharedPointer<Command>>
+{
+    QString name;
+
+    QItemSelection prevSelection;
+    QItemSelection postSelection;
+
+    qint64 size;
+    // a single edit that later edits next to it may join
+    bool mergeable;
+};
+
+class CommandCenter : public QObject {
+    Q_OBJECT
+
+public:
+    CommandCenter(QObject * parent, QTableView * tv, TableModel * model);
+
+    // the oldest steps are dropped once the history holds more than
+    // `bytes` or more than `steps` steps, 0 means no limit
+    void setLimits(qint64 bytes, int steps);
+
+    void begin(const QString &name);
+    void addCommand(Command * cmd);
+    // outside a transaction, an edit next to the one before is added to
+    // its step, so typing down a column is undone at once
+    void addEdit(int r, int c, const QString &oldText, const QString &newText);
+    void commit();
+
+    void undo();
+    void redo();
+
+    void clear();
+    int length();
+
+signals:
+    void commited();
+    void undone();
+    void redone();
+
+private:
+    bool _canMerge(int r, int c) const;
+    void _trim();
+
+private:
+    QTableView * m_tv;
+    TableModel * m_model;
+    QList<CommandGroup> m_history;
+    int m_curStatus;
+    QStack<QString> m_transStack;
+
+    // cell edits of the open transaction are collected here
+    SetCellsCommand * m_edits;
+
+    qint64 m_size;
+    qint64 m_sizeLimit;
+    int m_stepLimit;
+};
+
+#endif // COMMANDCENTER_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -26,18 +26,52 @@ DEFINES += QT_DEPRECATED_WARNINGS
 SOURCES += \
         main.cpp \
         mainwindow.cpp \
+        batchjob.cpp \
         csv.cpp \
+        csvfile.cpp \
+        csvloader.cpp \
         tablewidget.cpp \
-        dialogaddcolumn.cpp
+        tablemodel.cpp \
+        commandcenter.cpp \
+        cellstore.cpp \
+        expression.cpp \
+        exprlexer.cpp \
+        finder.cpp \
+        sorter.cpp \
+        rowfilter.cpp \
+        statistics.cpp \
+        dialogaddcolumn.cpp \
+        dialogfind.cpp \
+        dialogstorage.cpp \
+        statisticspanel.cpp
 
 HEADERS += \
         mainwindow.h \
+        batchjob.h \
         csv.h \
+        csvfile.h \
+        csvloader.h \
+        csvtokenizer.h \
         tablewidget.h \
-        dialogaddcolumn.h
+        tablemodel.h \
+        commandcenter.h \
+        cellstore.h \
+        expression.h \
+        exprlexer.h \
+        finder.h \
+        sorter.h \
+        rowfilter.h \
+        statistics.h \
+        dialogaddcolumn.h \
+        dialogfind.h \
+        dialogstorage.h \
+        statisticspanel.h
 
 FORMS += \
         mainwindow.ui \
-        dialogaddcolumn.ui
+        dialogaddcolumn.ui \
+        dialogfind.ui \
+        dialogstorage.ui \
+        statisticspanel.ui
 
 win32:RC_ICONS += icon.ico
@@ -1,98 +1,587 @@
 #include "csv.h"
+#include "csvtokenizer.h"
+#include "cellstore.h"
 
 #include <QFile>
+#include <QThread>
+#include <QtConcurrent>
 #include <QTextStream>
 #include <QTextCodec>
-#include <QRegExp>
 #include <QDebug>
 
-QList<QStringList> parse(const QString &string)
+#include <algorithm>
+
+// below this size the data is tokenized on the calling thread
+static const qint64 PARALLEL_THRESHOLD = 4 << 20;
+
+// output is handed to the device in pieces of this size
+static const int WRITE_BUFFER = 4 << 20;
+
+// the dialect is guessed from this much of a file, and this many rows
+static const qint64 SNIFF_SIZE = 256 << 10;
+static const int SNIFF_ROWS = 200;
+
+static const char DELIMITERS[] = { ',', ';', '\t', '|' };
+
+// parseGrid() reports progress this many times
+static const int PARSE_STEPS = 100;
+
+namespace
 {
-    enum State {Normal, Quote} state = Normal;
-    QList<QStringList> data;
-    QStringList line;
-    QString value;
+    struct ListBuilder
+    {
+        ListBuilder() : quote('"') {}
 
-    for (int i = 0; i < string.size(); i++) {
-        QChar current = string.at(i);
+        void field(const char * begin, const char * end, bool escaped) {
+            if (escaped)
+                line.append(CSV::unescape(begin, end, quote));
+            else
+                line.append(QString::fromUtf8(begin, end - begin));
+        }
 
-        // Normal
-        if (state == Normal) {
-            // newline
-            if (current == '\n') {
-                // add value
-                line.append(value);
-                value.clear();
-                // add line
-                data.append(line);
-                line.clear();
+        void reserve(qint64) {}
+
+        void row(qint64) {
+            data.append(line);
+            line.clear();
+        }
+
+        QList<QStringList> data;
+        QStringList line;
+        char quote;
+    };
+
+    // fields go into one buffer per part instead of a string each
+    struct GridBuilder
+    {
+        GridBuilder() : open(false), quote('"') {}
+
+        void field(const char * begin, const char * end, bool escaped) {
+            if (!open) {
+                grid.addRow();
+                open = true;
             }
-            // comma
-            else if (current == ',') {
-                // add line
-                line.append(value);
-                value.clear();
+            if (escaped) {
+                CSV::unescape(begin, end, unescaped, quote);
+                grid.addCell(unescaped.constData(), unescaped.size());
+            } else {
+                grid.addCell(begin, end - begin);
             }
-            // double quote
-            else if (current == '"') {
-                state = Quote;
+        }
+
+        // unescaped fields are never longer than their input
+        void reserve(qint64 size) {
+            grid.reserve(int(size));
+        }
+
+        void row(qint64) {
+            open = false;
+        }
+
+        CellGrid grid;
+        QByteArray unescaped;
+        bool open;
+        char quote;
+    };
+
+    struct Chunk
+    {
+        qint64 begin;
+        qint64 end;
+        // first newline outside quotes, if the chunk starts outside
+        // or inside a quote
+        qint64 newline[2];
+        // odd number of quotes in the chunk
+        bool odd;
+    };
+
+    template <typename Builder>
+    struct Part
+    {
+        qint64 begin;
+        qint64 end;
+        Builder builder;
+    };
+
+    // tokenizes pieces of the data on all cores, one builder per piece
+    template <typename Builder>
+    QVector<Part<Builder> > parseParts(const QByteArray &utf8, const CSV::Dialect &dialect)
+    {
+        const char * data = utf8.constData();
+        int threads = QThread::idealThreadCount();
+
+        QVector<qint64> bounds;
+        if (threads < 2 || utf8.size() < PARALLEL_THRESHOLD) {
+            bounds << 0 << utf8.size();
+        } else {
+            bounds = CSV::splitRows(data, utf8.size(), threads * 4, dialect.quote);
+        }
+
+        QVector<Part<Builder> > parts(bounds.size() - 1);
+        for (int k = 0; k < parts.size(); ++k) {
+            parts[k].begin = bounds[k];
+            parts[k].end = bounds[k + 1];
+            parts[k].builder.reserve(parts[k].end - parts[k].begin);
+            parts[k].builder.quote = dialect.quote;
+        }
+
+        if (parts.size() == 1) {
+            CSV::tokenize(data, utf8.size(), parts[0].builder, dialect);
+            return parts;
+        }
+
+        QtConcurrent::blockingMap(parts, [data, &dialect](Part<Builder> &part) {
+            CSV::tokenize(data + part.begin, part.end - part.begin, part.builder, dialect);
+        });
+        return parts;
+    }
+}
+
+CSV::LineEndings &CSV::LineEndings::operator+=(const LineEndings &other)
+{
+    crlf += other.crlf;
+    lf += other.lf;
+    cr += other.cr;
+    return *this;
+}
+
+QString CSV::LineEndings::guess() const
+{
+    if (lf >= crlf && lf >= cr)
+        return "\n";
+    if (crlf >= cr)
+        return "\r\n";
+    return "\r";
+}
+
+namespace
+{
+    // how often c opens a field split by the delimiter
+    int fieldStarts(const char * data, qint64 size, char c, char delimiter)
+    {
+        int count = 0;
+        for (qint64 i = 0; i < size; ++i) {
+            if (data[i] == c && (i == 0 || data[i - 1] == '\n' || data[i - 1] == delimiter)) {
+                count += 1;
             }
-            // character
-            else {
-                value += current;
+        }
+        return count;
+    }
+
+    // how many fields the quote opens, or -1 when one of them is not
+    // closed right before the delimiter or the end of its row
+    int quotedFields(const char * data, qint64 size, char quote, char delimiter, bool complete)
+    {
+        int count = 0;
+        for (qint64 i = 0; i < size; ++i) {
+            if (data[i] != quote || !(i == 0 || data[i - 1] == '\n' || data[i - 1] == delimiter))
+                continue;
+
+            // a doubled quote is part of the field
+            qint64 j = i + 1;
+            while (j < size && (data[j] != quote || (j + 1 < size && data[j + 1] == quote))) {
+                j += data[j] == quote ? 2 : 1;
+            }
+
+            // the sample may end inside the last field
+            if (j >= size)
+                return complete ? -1 : count;
+            if (j + 1 < size && data[j + 1] != delimiter && data[j + 1] != '\n' && data[j + 1] != '\r')
+                return -1;
+
+            count += 1;
+            i = j;
+        }
+        return count;
+    }
+
+    // the delimiter found the same number of times on most rows, and the
+    // most often among those
+    char guessDelimiter(const char * data, qint64 size, char quoteChar, bool complete)
+    {
+        const int candidates = int(sizeof(DELIMITERS));
+        QVector<QVector<int> > counts(candidates);
+        int current[candidates] = {};
+        bool quote = false;
+
+        for (qint64 i = 0; i < size; ++i) {
+            char c = data[i];
+            if (c == quoteChar) {
+                quote = !quote;
+            } else if (quote) {
+                continue;
+            } else if (c == '\n') {
+                for (int k = 0; k < candidates; ++k) {
+                    counts[k].append(current[k]);
+                    current[k] = 0;
+                }
+                if (counts[0].size() >= SNIFF_ROWS)
+                    break;
+            } else {
+                const char * d = static_cast<const char *>(memchr(DELIMITERS, c, candidates));
+                if (d)
+                    current[d - DELIMITERS] += 1;
             }
         }
-        // Quote
-        else if (state == Quote) {
-            // double quote
-            if (current == '"') {
-                int index = (i+1 < string.size()) ? i+1 : string.size();
-                QChar next = string.at(index);
-                if (next == '"') {
-                    value += '"';
-                    i++;
+
+        // a last row without newline only counts when nothing was cut off
+        if (complete && counts[0].size() < SNIFF_ROWS) {
+            for (int k = 0; k < candidates; ++k) {
+                counts[k].append(current[k]);
+            }
+        }
+
+        char best = DELIMITERS[0];
+        int bestRows = 0;
+        int bestCount = 0;
+        for (int k = 0; k < candidates; ++k) {
+            QVector<int> sorted = counts[k];
+            std::sort(sorted.begin(), sorted.end());
+
+            // the most frequent count per row
+            int mode = 0;
+            int modeRows = 0;
+            for (int i = 0; i < sorted.size();) {
+                int j = i;
+                while (j < sorted.size() && sorted[j] == sorted[i])
+                    ++j;
+                if (sorted[i] > 0 && j - i > modeRows) {
+                    mode = sorted[i];
+                    modeRows = j - i;
+                }
+                i = j;
+            }
+
+            if (modeRows > bestRows || (modeRows == bestRows && mode > bestCount)) {
+                best = DELIMITERS[k];
+                bestRows = modeRows;
+                bestCount = mode;
+            }
+        }
+        return best;
+    }
+}
+
+CSV::Dialect CSV::sniff(const char * data, qint64 size)
+{
+    Dialect dialect;
+
+    // byte order marks
+    if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+        dialect.bom = 3;
+    } else if (size >= 2 && memcmp(data, "\xFF\xFE", 2) == 0) {
+        dialect.bom = 2;
+        dialect.codec = "UTF-16LE";
+    } else if (size >= 2 && memcmp(data, "\xFE\xFF", 2) == 0) {
+        dialect.bom = 2;
+        dialect.codec = "UTF-16BE";
+    }
+
+    const char * text = data + dialect.bom;
+    qint64 length = qMin(size - dialect.bom, SNIFF_SIZE);
+    bool complete = length == size - dialect.bom;
+
+    // look at whole rows only, a sample cut in the middle of a character
+    // is not valid utf-8
+    if (!complete && dialect.codec == "UTF-8") {
+        qint64 end = length;
+        while (end > 0 && text[end - 1] != '\n')
+            --end;
+        if (end > 0)
+            length = end;
+    }
+
+    QByteArray converted;
+    if (dialect.codec == "UTF-8") {
+        QTextCodec::ConverterState state;
+        QTextCodec::codecForMib(106)->toUnicode(text, int(length), &state);
+        if (state.invalidChars > 0) {
+            // most likely what the spreadsheet of the user wrote
+            QTextCodec * locale = QTextCodec::codecForLocale();
+            dialect.codec = locale->mibEnum() == 106 ? QByteArray("Windows-1252") : locale->name();
+        }
+    } else {
+        QTextCodec * codec = QTextCodec::codecForName(dialect.codec);
+        converted = codec->toUnicode(text, int(length & ~qint64(1))).toUtf8();
+        text = converted.constData();
+        length = converted.size();
+    }
+
+    // a single quote only when no field starts with a double quote and
+    // the fields it opens are all closed again, an apostrophe at the start
+    // of a word must not turn the rest of the row into one field
+    dialect.delimiter = guessDelimiter(text, length, dialect.quote, complete);
+    if (fieldStarts(text, length, '"', dialect.delimiter) == 0
+            && quotedFields(text, length, '\'', dialect.delimiter, complete) > 0) {
+        char delimiter = guessDelimiter(text, length, '\'', complete);
+        if (quotedFields(text, length, '\'', delimiter, complete) > 0) {
+            dialect.quote = '\'';
+            dialect.delimiter = delimiter;
+        }
+    }
+
+    LineEndings endings;
+    for (qint64 i = 0; i < length; ++i) {
+        if (text[i] == '\n') {
+            if (i > 0 && text[i - 1] == '\r')
+                endings.crlf += 1;
+            else
+                endings.lf += 1;
+        } else if (text[i] == '\r' && (i + 1 >= length || text[i + 1] != '\n')) {
+            endings.cr += 1;
+        }
+    }
+    dialect.crlf = endings.guess();
+
+    return dialect;
+}
+
+QString CSV::unescape(const char * begin, const char * end, char quote)
+{
+    QByteArray value;
+    unescape(begin, end, value, quote);
+    return QString::fromUtf8(value);
+}
+
+void CSV::unescape(const char * begin, const char * end, QByteArray &value, char quote)
+{
+    enum State {Normal, Quote} state = Normal;
+
+    // keeps the capacity, so the buffer can be reused for every field
+    value.resize(0);
+    value.reserve(end - begin);
+
+    for (const char * p = begin; p < end; ++p) {
+        char current = *p;
+
+        // crlf is read as lf
+        if (current == '\r' && p + 1 < end && p[1] == '\n') {
+            continue;
+        }
+
+        if (state == Normal) {
+            if (current == quote) {
+                state = Quote;
+            } else {
+                value += current;
+            }
+        } else {
+            if (current == quote) {
+                if (p + 1 < end && p[1] == quote) {
+                    value += quote;
+                    ++p;
                 } else {
                     state = Normal;
                 }
-            }
-            // other
-            else {
+            } else {
                 value += current;
             }
         }
     }
 
-    return data;
 }
 
-QString initString(const QString &string)
+QVector<qint64> CSV::splitRows(const char * data, qint64 size, int count, char quoteChar)
 {
-    QString result = string;
-    result.replace("\r\n", "\n");
-    if (result.at(result.size()-1) != '\n') {
-        result += '\n';
+    QVector<Chunk> chunks(qMax(count, 1));
+    for (int k = 0; k < chunks.size(); ++k) {
+        chunks[k].begin = size * k / chunks.size();
+        chunks[k].end = size * (k + 1) / chunks.size();
+    }
+
+    // The quote state at the start of a chunk is not known until all chunks
+    // before it have been scanned, so look for a row boundary under both
+    // assumptions and count the quotes to pick the right one afterwards.
+    QtConcurrent::blockingMap(chunks, [data, quoteChar](Chunk &chunk) {
+        bool odd = false;
+        chunk.newline[0] = chunk.newline[1] = -1;
+
+        qint64 i = chunk.begin;
+        for (; i < chunk.end && (chunk.newline[0] < 0 || chunk.newline[1] < 0); ++i) {
+            if (data[i] == quoteChar) {
+                odd = !odd;
+            } else if (data[i] == '\n' && chunk.newline[odd] < 0) {
+                chunk.newline[odd] = i;
+            }
+        }
+
+        odd ^= std::count(data + i, data + chunk.end, quoteChar) & 1;
+        chunk.odd = odd;
+    });
+
+    QVector<qint64> bounds;
+    bounds.append(0);
+
+    bool quote = false;
+    for (int k = 0; k < chunks.size(); ++k) {
+        qint64 newline = chunks[k].newline[quote];
+        if (k > 0 && newline >= 0 && newline + 1 < size) {
+            bounds.append(newline + 1);
+        }
+        quote ^= chunks[k].odd;
+    }
+
+    bounds.append(size);
+    return bounds;
+}
+
+QList<QStringList> parse(const QByteArray &utf8)
+{
+    QVector<Part<ListBuilder> > parts = parseParts<ListBuilder>(utf8, CSV::Dialect());
+    if (parts.size() == 1) {
+        return parts[0].builder.data;
+    }
+
+    int rows = 0;
+    for (int k = 0; k < parts.size(); ++k) {
+        rows += parts[k].builder.data.size();
+    }
+
+    QList<QStringList> result;
+    result.reserve(rows);
+    for (int k = 0; k < parts.size(); ++k) {
+        result.append(parts[k].builder.data);
     }
     return result;
 }
 
+// Decimal numbers without an exponent are parsed by hand, which is
+// exact as long as the digits fit in a double; anything else goes
+// through QByteArray.
+bool CSV::toNumber(const char * data, int length, double &value)
+{
+    const char * p = data;
+    const char * end = data + length;
+    while (p < end && *p == ' ')
+        ++p;
+    while (end > p && end[-1] == ' ')
+        --end;
+    if (p == end)
+        return false;
+
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+        negative = *p == '-';
+        ++p;
+    }
+
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+
+    quint64 mantissa = 0;
+    int digits = 0;
+    int decimals = -1;
+    for (; p < end; ++p) {
+        if (*p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += 1;
+            if (decimals >= 0)
+                decimals += 1;
+        } else if (*p == '.' && decimals < 0) {
+            decimals = 0;
+        } else {
+            break;
+        }
+    }
+
+    if (p == end && digits > 0 && digits <= 15) {
+        value = double(mantissa) / powers[qMax(decimals, 0)];
+        if (negative)
+            value = -value;
+        return true;
+    }
+    if (digits == 0)
+        return false;
+
+    bool ok = false;
+    value = QByteArray(data, length).trimmed().toDouble(&ok);
+    return ok;
+}
+
 QList<QStringList> CSV::parseFromString(const QString &string)
 {
-    return parse(initString(string));
+    return parse(string.toUtf8());
+}
+
+QVector<CellGrid> CSV::parseGrids(const QByteArray &bytes, const Dialect &dialect)
+{
+    // utf-8 is tokenized in place, anything else is converted first
+    QByteArray utf8;
+    if (dialect.codec == "UTF-8") {
+        utf8 = bytes.mid(dialect.bom);
+    } else {
+        QTextCodec * codec = QTextCodec::codecForName(dialect.codec);
+        if (!codec) {
+            codec = QTextCodec::codecForLocale();
+        }
+        utf8 = codec->toUnicode(bytes.constData() + dialect.bom, bytes.size() - dialect.bom).toUtf8();
+    }
+
+    QVector<Part<GridBuilder> > parts = parseParts<GridBuilder>(utf8, dialect);
+
+    QVector<CellGrid> grids;
+    grids.reserve(parts.size());
+    for (int k = 0; k < parts.size(); ++k) {
+        grids.append(parts[k].builder.grid);
+    }
+    return grids;
+}
+
+CellGrid CSV::parseGrid(const QByteArray &utf8, QAtomicInt * progress)
+{
+    Dialect dialect;
+    const char * data = utf8.constData();
+    QVector<qint64> bounds = splitRows(data, utf8.size(), PARSE_STEPS, dialect.quote);
+
+    GridBuilder builder;
+    builder.reserve(utf8.size());
+    for (int k = 0; k + 1 < bounds.size(); ++k) {
+        tokenize(data + bounds[k], bounds[k + 1] - bounds[k], builder, dialect);
+        if (progress) {
+            progress->store(int(bounds[k + 1] * 1000 / qMax(utf8.size(), 1)));
+        }
+    }
+    return builder.grid;
 }
 
 QList<QStringList> CSV::parseFromFile(const QString &filename, const QString &codec)
 {
-    QString string;
+    QByteArray bytes;
     QFile file(filename);
     if (file.open(QIODevice::ReadOnly)) {
-        QTextStream in(&file);
-        if (!codec.isEmpty()) {
-          in.setCodec(QTextCodec::codecForName(codec.toLatin1()));
-        }
-        string = in.readAll();
+        bytes = file.readAll();
         file.close();
     }
-    return parse(initString(string));
+
+    QTextCodec * defaultCodec = nullptr;
+    if (!codec.isEmpty()) {
+        defaultCodec = QTextCodec::codecForName(codec.toLatin1());
+    }
+    if (!defaultCodec) {
+        defaultCodec = QTextCodec::codecForLocale();
+    }
+    QTextCodec * c = QTextCodec::codecForUtfText(bytes, defaultCodec);
+
+    // utf-8 is tokenized in place, anything else is converted first
+    if (c->mibEnum() == 106) {
+        if (bytes.startsWith("\xEF\xBB\xBF")) {
+            bytes.remove(0, 3);
+        }
+        return parse(bytes);
+    }
+    return parse(c->toUnicode(bytes).toUtf8());
+}
+
+QString escape(QString value)
+{
+    if (value.contains(',') || value.contains('"') ||
+            value.contains('\n') || value.contains('\r')) {
+        value.replace("\"", "\"\"");
+        return "\"" + value + "\"";
+    }
+    return value;
 }
 
 bool CSV::write(const QList<QStringList> data,
@@ -112,14 +601,8 @@ bool CSV::write(const QList<QStringList> data,
 
     foreach (const QStringList &line, data) {
         QStringList output;
-        foreach (QString value, line) {
-            if (value.contains(QRegExp(",|\r\n"))) {
-                output << ("\"" + value + "\"");
-            } else if (value.contains("\"")) {
-                output << value.replace("\"", "\"\"");
-            } else {
-                output << value;
-            }
+        foreach (const QString &value, line) {
+            output << escape(value);
         }
         out << output.join(",") << crlf;
     }
@@ -137,17 +620,170 @@ QString CSV::toString(const QList<QStringList> data,
 
     foreach (const QStringList &line, data) {
         QStringList output;
-        foreach (QString value, line) {
-            if (value.contains(QRegExp(",|\r\n"))) {
-                output << ("\"" + value + "\"");
-            } else if (value.contains("\"")) {
-                output << value.replace("\"", "\"\"");
-            } else {
-                output << value;
-            }
+        foreach (const QString &value, line) {
+            output << escape(value);
         }
         out << output.join(",") << crlf;
     }
 
     return r;
 }
+
+CSV::Writer::Writer(QIODevice * device, const QString &crlf)
+    : m_device(device)
+    , m_buffer(WRITE_BUFFER, Qt::Uninitialized)
+    , m_used(0)
+    , m_crlf(crlf.toLatin1())
+    , m_delimiter(',')
+    , m_quote('"')
+    , m_rowStart(true)
+    , m_error(false)
+{
+}
+
+CSV::Writer::Writer(QIODevice * device, const Dialect &dialect)
+    : m_device(device)
+    , m_buffer(WRITE_BUFFER, Qt::Uninitialized)
+    , m_used(0)
+    , m_crlf(dialect.crlf.toLatin1())
+    , m_delimiter(dialect.delimiter)
+    , m_quote(dialect.quote)
+    , m_rowStart(true)
+    , m_error(false)
+{
+    QTextCodec * codec = QTextCodec::codecForName(dialect.codec);
+    if (!codec) {
+        codec = QTextCodec::codecForLocale();
+    }
+
+    // the mark is written by hand, encoders must not add their own
+    if (dialect.bom > 0) {
+        QScopedPointer<QTextEncoder> encoder(codec->makeEncoder(QTextCodec::IgnoreHeader));
+        m_bom = encoder->fromUnicode(QString(QChar(QChar::ByteOrderMark)));
+    }
+    if (codec->mibEnum() != 106) {
+        m_decoder.reset(QTextCodec::codecForMib(106)->makeDecoder());
+        m_encoder.reset(codec->makeEncoder(QTextCodec::IgnoreHeader));
+    }
+}
+
+CSV::Writer::~Writer()
+{
+    flush();
+}
+
+void CSV::Writer::writeField(const char * data, int length)
+{
+    if (!m_rowStart) {
+        _append(&m_delimiter, 1);
+    }
+    m_rowStart = false;
+
+    bool quote = false;
+    int quotes = 0;
+    for (int i = 0; i < length; ++i) {
+        char c = data[i];
+        if (c == m_quote) {
+            quote = true;
+            quotes += 1;
+        } else if (c == m_delimiter || c == '\n' || c == '\r') {
+            quote = true;
+        }
+    }
+
+    if (!quote) {
+        _append(data, length);
+        return;
+    }
+
+    _append(&m_quote, 1);
+    if (quotes == 0) {
+        _append(data, length);
+    } else {
+        const char * begin = data;
+        const char * end = data + length;
+        for (const char * p = begin; p < end; ++p) {
+            if (*p == m_quote) {
+                // write up to and including the quote, then double it
+                _append(begin, p - begin + 1);
+                _append(&m_quote, 1);
+                begin = p + 1;
+            }
+        }
+        _append(begin, end - begin);
+    }
+    _append(&m_quote, 1);
+}
+
+void CSV::Writer::writeField(const QString &value)
+{
+    QByteArray utf8 = value.toUtf8();
+    writeField(utf8.constData(), utf8.size());
+}
+
+void CSV::Writer::endRow()
+{
+    _append(m_crlf.constData(), m_crlf.size());
+    m_rowStart = true;
+}
+
+bool CSV::Writer::flush()
+{
+    // also when nothing is buffered, rows copied from the original file
+    // go to the device right after a flush
+    if (m_used > 0 || !m_bom.isEmpty()) {
+        _write(m_buffer.constData(), m_used);
+    }
+    m_used = 0;
+    return !m_error;
+}
+
+bool CSV::Writer::hasError() const
+{
+    return m_error;
+}
+
+void CSV::Writer::setError()
+{
+    m_error = true;
+}
+
+QIODevice * CSV::Writer::device() const
+{
+    return m_device;
+}
+
+void CSV::Writer::_append(const char * data, int length)
+{
+    if (m_used + length > m_buffer.size()) {
+        flush();
+
+        // too big for the buffer anyway
+        if (length > m_buffer.size()) {
+            _write(data, length);
+            return;
+        }
+    }
+
+    memcpy(m_buffer.data() + m_used, data, length);
+    m_used += length;
+}
+
+void CSV::Writer::_write(const char * data, int length)
+{
+    if (!m_bom.isEmpty() && !m_error) {
+        m_error = m_device->write(m_bom) != m_bom.size();
+    }
+    m_bom.clear();
+    if (m_error) {
+        return;
+    }
+
+    if (m_encoder) {
+        // the decoder keeps a character cut at the end for the next call
+        QByteArray encoded = m_encoder->fromUnicode(m_decoder->toUnicode(data, length));
+        m_error = m_device->write(encoded) != encoded.size();
+    } else {
+        m_error = m_device->write(data, length) != length;
+    }
+}
@@ -1,7 +1,17 @@
 #ifndef CSV_H
 #define CSV_H
 
+#include <QScopedPointer>
 #include <QStringList>
+#include <QVector>
+
+#include "csvtokenizer.h"
+
+class QAtomicInt;
+class QIODevice;
+class QTextDecoder;
+class QTextEncoder;
+class CellGrid;
 
 namespace CSV
 {
@@ -9,6 +19,17 @@ namespace CSV
     QList<QStringList> parseFromFile(const QString &filename,
             const QString &codec = QString());
 
+    // Parses a whole file into one packed grid per piece of the input, so
+    // a load makes a few large allocations instead of one string per field.
+    QVector<CellGrid> parseGrids(const QByteArray &bytes, const Dialect &dialect);
+
+    // Parses utf-8 csv into a single grid, front to back in pieces so that
+    // `progress` can follow along from 0 to 1000.
+    CellGrid parseGrid(const QByteArray &utf8, QAtomicInt * progress = nullptr);
+
+    // the number in a field, spaces around it are allowed
+    bool toNumber(const char * data, int length, double &value);
+
     bool write(const QList<QStringList> data,
             const QString &filename,
             const QString &codec = QString(),
@@ -16,6 +37,46 @@ namespace CSV
 
     QString toString(const QList<QStringList> data,
                      const QString &crlf = "\r\n");
+
+    // Buffered csv output. Fields are given as utf-8 and written in the
+    // encoding of the dialect, after its byte order mark if it has one. A
+    // field is quoted only when it contains the delimiter, the quote or a
+    // line break.
+    class Writer
+    {
+    public:
+        Writer(QIODevice * device, const QString &crlf = "\r\n");
+        Writer(QIODevice * device, const Dialect &dialect);
+        ~Writer();
+
+        void writeField(const char * data, int length);
+        void writeField(const QString &value);
+        void endRow();
+
+        bool flush();
+        bool hasError() const;
+        void setError();
+        QIODevice * device() const;
+
+    private:
+        void _append(const char * data, int length);
+        void _write(const char * data, int length);
+
+    private:
+        QIODevice * m_device;
+        QByteArray m_buffer;
+        int m_used;
+        QByteArray m_crlf;
+        char m_delimiter;
+        char m_quote;
+        bool m_rowStart;
+        bool m_error;
+        // written before anything else
+        QByteArray m_bom;
+        // only for encodings other than utf-8
+        QScopedPointer<QTextDecoder> m_decoder;
+        QScopedPointer<QTextEncoder> m_encoder;
+    };
 }
 
 #endif // CSV_H
@@ -0,0 +1,537 @@
+#include "csvfile.h"
+#include "csvtokenizer.h"
+
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <QtConcurrent>
+
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+// below this size the index is built on the calling thread
+static const qint64 PARALLEL_THRESHOLD = 4 << 20;
+
+// smaller files are scanned about as fast as their index is read back
+static const qint64 SAVE_INDEX_THRESHOLD = 16 << 20;
+
+// the fingerprint hashes this many pages spread over the file
+static const int FINGERPRINT_PAGES = 64;
+static const int FINGERPRINT_PAGE = 4096;
+
+static const quint32 INDEX_MAGIC = 0x43535649;
+static const quint32 INDEX_VERSION = 1;
+
+static QAtomicInt nextFileId;
+
+namespace
+{
+    // counts rows and records where every BLOCK_ROWS-th one starts, given
+    // how many rows come before the data
+    struct IndexBuilder
+    {
+        IndexBuilder(QVector<qint64> * marks, qint64 base, qint64 rows)
+            : marks(marks), base(base), rows(rows), end(base)
+        {
+        }
+
+        void field(const char *, const char *, bool) {
+        }
+
+        void row(qint64 e) {
+            rows += 1;
+            end = base + e;
+            if (marks && rows % CsvFile::BLOCK_ROWS == 0)
+                marks->append(end);
+        }
+
+        QVector<qint64> * marks;
+        qint64 base;
+        qint64 rows;
+        qint64 end;
+    };
+
+    // records where every row ends, which is where the next one starts
+    struct EndsBuilder
+    {
+        EndsBuilder(QVector<qint64> &rows, qint64 base)
+            : rows(rows), base(base)
+        {
+        }
+
+        void field(const char *, const char *, bool) {
+        }
+
+        void row(qint64 end) {
+            rows.append(base + end);
+        }
+
+        QVector<qint64> &rows;
+        qint64 base;
+    };
+
+    struct RowBuilder
+    {
+        RowBuilder(char quote)
+            : quote(quote)
+        {
+        }
+
+        void field(const char * begin, const char * end, bool escaped) {
+            if (escaped)
+                line.append(CSV::unescape(begin, end, quote));
+            else
+                line.append(QString::fromUtf8(begin, end - begin));
+        }
+
+        void row(qint64) {
+        }
+
+        QStringList line;
+        char quote;
+    };
+
+    struct SliceBuilder
+    {
+        SliceBuilder(QVector<CSV::Slice> &fields)
+            : fields(fields)
+        {
+        }
+
+        void field(const char * begin, const char * end, bool escaped) {
+            CSV::Slice slice;
+            slice.begin = begin;
+            slice.end = end;
+            slice.escaped = escaped;
+            fields.append(slice);
+        }
+
+        void row(qint64) {
+        }
+
+        QVector<CSV::Slice> &fields;
+    };
+
+    struct Part
+    {
+        qint64 begin;
+        qint64 end;
+        qint64 rows;
+        QVector<qint64> marks;
+        CSV::LineEndings endings;
+    };
+
+    // the rows of one block, as the start of every row and the end of
+    // the last one
+    struct Block
+    {
+        int file = 0;
+        int block = -1;
+        int rows = 0;
+        QVector<qint64> offsets;
+    };
+}
+
+CsvFile::CsvFile()
+    : m_data(nullptr), m_size(0), m_id(0), m_rowCount(0), m_indexed(0)
+{
+}
+
+CsvFile::~CsvFile()
+{
+    close();
+}
+
+bool CsvFile::open(const QString &filename, bool index)
+{
+    close();
+
+    m_file.setFileName(filename);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    uchar * data = m_size > 0 ? m_file.map(0, m_size) : nullptr;
+    if (!data) {
+        close();
+        return false;
+    }
+    m_data = reinterpret_cast<const char *>(data);
+
+    // other encodings cannot be read in place
+    m_dialect = CSV::sniff(m_data, m_size);
+    if (m_dialect.codec != "UTF-8") {
+        close();
+        return false;
+    }
+    m_id = nextFileId.fetchAndAddRelaxed(1) + 1;
+    m_marks.append(m_dialect.bom);
+    m_indexed = m_dialect.bom;
+
+    if (_loadIndex()) {
+        return true;
+    }
+    if (index) {
+        _buildIndex();
+        saveIndex();
+    }
+    return true;
+}
+
+void CsvFile::close()
+{
+    if (m_data) {
+        m_file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(m_data)));
+        m_data = nullptr;
+    }
+    m_file.close();
+    m_size = 0;
+    m_rowCount = 0;
+    m_marks.clear();
+    m_indexed = 0;
+    m_endings = CSV::LineEndings();
+    m_dialect = CSV::Dialect();
+}
+
+QString CsvFile::filename() const
+{
+    return m_file.fileName();
+}
+
+qint64 CsvFile::size() const
+{
+    return m_size;
+}
+
+const char * CsvFile::data() const
+{
+    return m_data;
+}
+
+int CsvFile::rowCount() const
+{
+    return m_rowCount;
+}
+
+QStringList CsvFile::row(int r) const
+{
+    const QVector<qint64> &offsets = _block(r / BLOCK_ROWS);
+    qint64 begin = offsets.at(r % BLOCK_ROWS);
+    qint64 end = offsets.at(r % BLOCK_ROWS + 1);
+
+    RowBuilder builder(m_dialect.quote);
+    CSV::tokenize(m_data + begin, end - begin, builder, m_dialect);
+    return builder.line;
+}
+
+void CsvFile::rowFields(int r, QVector<CSV::Slice> &fields) const
+{
+    const QVector<qint64> &offsets = _block(r / BLOCK_ROWS);
+    qint64 begin = offsets.at(r % BLOCK_ROWS);
+    qint64 end = offsets.at(r % BLOCK_ROWS + 1);
+
+    fields.resize(0);
+    SliceBuilder builder(fields);
+    CSV::tokenize(m_data + begin, end - begin, builder, m_dialect);
+}
+
+const CSV::Dialect & CsvFile::dialect() const
+{
+    return m_dialect;
+}
+
+QString CsvFile::crlf() const
+{
+    // the sample until rows have been counted
+    if (m_endings.crlf + m_endings.lf + m_endings.cr == 0) {
+        return m_dialect.crlf;
+    }
+    return m_endings.guess();
+}
+
+qint64 CsvFile::rowBegin(int r) const
+{
+    // the first row starts after the byte order mark, which the writer
+    // puts out on its own
+    return _block(r / BLOCK_ROWS).at(r % BLOCK_ROWS);
+}
+
+qint64 CsvFile::rowEnd(int r) const
+{
+    return _block(r / BLOCK_ROWS).at(r % BLOCK_ROWS + 1);
+}
+
+bool CsvFile::copy(qint64 begin, qint64 end, QIODevice * out) const
+{
+#ifdef Q_OS_LINUX
+    // let the kernel copy between the files, without going through
+    // user space
+    QFileDevice * file = qobject_cast<QFileDevice *>(out);
+    if (file && file->flush()) {
+        loff_t in = begin;
+        loff_t at = file->pos();
+        while (in < end) {
+            ssize_t n = copy_file_range(m_file.handle(), &in, file->handle(), &at, end - in, 0);
+            if (n <= 0)
+                break;
+        }
+        if (!file->seek(at))
+            return false;
+        begin = in;
+    }
+#endif
+
+    return out->write(m_data + begin, end - begin) == end - begin;
+}
+
+qint64 CsvFile::indexed() const
+{
+    return m_indexed;
+}
+
+qint64 CsvFile::scanRows(qint64 from, qint64 length, QVector<qint64> &ends,
+                         CSV::LineEndings &endings) const
+{
+    qint64 to = from + length;
+    QVector<qint64> found;
+    CSV::LineEndings counted;
+
+    EndsBuilder builder(found, from);
+    CSV::tokenizeRows(m_data + from, length, builder, m_dialect, &counted);
+
+    // unless this is the end of the file, the last row may be cut off
+    if (to < m_size && !found.isEmpty() && found.last() == to && m_data[to - 1] != '\n') {
+        found.removeLast();
+    }
+
+    qint64 next = found.isEmpty() ? from : found.last();
+
+    // the rest is scanned again next time, do not count it twice
+    for (qint64 i = next; i < to; ++i) {
+        if (m_data[i] == '\n') {
+            if (i > from && m_data[i - 1] == '\r')
+                counted.crlf -= 1;
+            else
+                counted.lf -= 1;
+        } else if (m_data[i] == '\r') {
+            if (i + 1 >= to || m_data[i + 1] != '\n')
+                counted.cr -= 1;
+        }
+    }
+
+    ends += found;
+    endings += counted;
+    return next;
+}
+
+void CsvFile::appendRows(const QVector<qint64> &ends, const CSV::LineEndings &endings)
+{
+    foreach (qint64 end, ends) {
+        m_rowCount += 1;
+        if (m_rowCount % BLOCK_ROWS == 0)
+            m_marks.append(end);
+    }
+    if (!ends.isEmpty()) {
+        m_indexed = ends.last();
+    }
+    m_endings += endings;
+}
+
+bool CsvFile::saveIndex() const
+{
+    if (!m_data || m_indexed < m_size || m_size < SAVE_INDEX_THRESHOLD) {
+        return false;
+    }
+
+    QString path = _indexPath();
+    if (path.isEmpty() || !QDir().mkpath(QFileInfo(path).absolutePath())) {
+        return false;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream out(&file);
+    out << INDEX_MAGIC << INDEX_VERSION
+        << QFileInfo(m_file).absoluteFilePath() << m_size
+        << QFileInfo(m_file).lastModified().toMSecsSinceEpoch() << _fingerprint()
+        << qint8(m_dialect.delimiter) << qint8(m_dialect.quote)
+        << qint32(BLOCK_ROWS) << qint32(m_rowCount) << m_indexed
+        << m_endings.crlf << m_endings.lf << m_endings.cr
+        << m_marks;
+
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+bool CsvFile::_loadIndex()
+{
+    QString path = _indexPath();
+    if (path.isEmpty() || m_size < SAVE_INDEX_THRESHOLD) {
+        return false;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION) {
+        return false;
+    }
+
+    // the index only holds for the very file it was built from
+    QString filename;
+    qint64 size, modified;
+    QByteArray fingerprint;
+    qint8 delimiter, quote;
+    qint32 blockRows;
+    in >> filename >> size >> modified >> fingerprint >> delimiter >> quote >> blockRows;
+    if (in.status() != QDataStream::Ok
+            || filename != QFileInfo(m_file).absoluteFilePath() || size != m_size
+            || modified != QFileInfo(m_file).lastModified().toMSecsSinceEpoch()
+            || delimiter != m_dialect.delimiter || quote != m_dialect.quote
+            || blockRows != BLOCK_ROWS || fingerprint != _fingerprint()) {
+        return false;
+    }
+
+    qint32 rows;
+    qint64 indexed;
+    CSV::LineEndings endings;
+    QVector<qint64> marks;
+    in >> rows >> indexed >> endings.crlf >> endings.lf >> endings.cr >> marks;
+    if (in.status() != QDataStream::Ok || rows < 0 || indexed != m_size
+            || marks.size() != rows / BLOCK_ROWS + 1 || marks.first() != m_dialect.bom
+            || endings.crlf < 0 || endings.lf < 0 || endings.cr < 0) {
+        return false;
+    }
+
+    // a damaged index would send rows past the end of the mapping, every
+    // block starts after a line break and after the one before it
+    for (int i = 1; i < marks.size(); ++i) {
+        qint64 mark = marks[i];
+        if (mark <= marks[i - 1] || mark > m_size
+                || (m_data[mark - 1] != '\n' && m_data[mark - 1] != '\r')) {
+            return false;
+        }
+    }
+
+    m_rowCount = rows;
+    m_indexed = indexed;
+    m_endings = endings;
+    m_marks = marks;
+    return true;
+}
+
+QString CsvFile::_indexPath() const
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (dir.isEmpty()) {
+        return QString();
+    }
+
+    QByteArray key = QFileInfo(m_file).absoluteFilePath().toUtf8();
+    QByteArray name = QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex();
+    return dir + "/index/" + QString::fromLatin1(name) + ".idx";
+}
+
+QByteArray CsvFile::_fingerprint() const
+{
+    // hashing everything would cost as much as the scan it saves, pages
+    // from all over the file catch edits that keep the size and time
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    qint64 page = qMin<qint64>(FINGERPRINT_PAGE, m_size);
+    for (int k = 0; k < FINGERPRINT_PAGES; ++k) {
+        qint64 at = (m_size - page) * k / (FINGERPRINT_PAGES - 1);
+        hash.addData(m_data + at, int(page));
+    }
+    return hash.result();
+}
+
+void CsvFile::_buildIndex()
+{
+    qint64 begin = m_indexed;
+
+    const char * data = m_data + begin;
+    qint64 size = m_size - begin;
+    int threads = QThread::idealThreadCount();
+
+    if (threads < 2 || size < PARALLEL_THRESHOLD) {
+        IndexBuilder builder(&m_marks, begin, m_rowCount);
+        CSV::tokenizeRows(data, size, builder, m_dialect, &m_endings);
+        m_rowCount = builder.rows;
+        m_indexed = builder.end;
+        return;
+    }
+
+    QVector<qint64> bounds = CSV::splitRows(data, size, threads * 4, m_dialect.quote);
+    QVector<Part> parts(bounds.size() - 1);
+    for (int k = 0; k < parts.size(); ++k) {
+        parts[k].begin = bounds[k];
+        parts[k].end = bounds[k + 1];
+    }
+
+    // which rows are marked depends on the rows before each part, so
+    // the parts are counted first and marked in a second pass
+    const CSV::Dialect &dialect = m_dialect;
+    QtConcurrent::blockingMap(parts, [data, &dialect](Part &part) {
+        IndexBuilder builder(nullptr, 0, 0);
+        CSV::tokenizeRows(data + part.begin, part.end - part.begin, builder, dialect, &part.endings);
+        part.rows = builder.rows;
+    });
+
+    qint64 rows = m_rowCount;
+    for (int k = 0; k < parts.size(); ++k) {
+        qint64 before = rows;
+        rows += parts[k].rows;
+        parts[k].rows = before;
+    }
+
+    QtConcurrent::blockingMap(parts, [data, begin, &dialect](Part &part) {
+        IndexBuilder builder(&part.marks, begin + part.begin, part.rows);
+        CSV::tokenizeRows(data + part.begin, part.end - part.begin, builder, dialect);
+    });
+
+    for (int k = 0; k < parts.size(); ++k) {
+        m_marks += parts[k].marks;
+        m_endings += parts[k].endings;
+    }
+    m_rowCount = rows;
+    m_indexed = begin + bounds.last();
+}
+
+const QVector<qint64> & CsvFile::_block(int b) const
+{
+    static thread_local Block cache;
+
+    int rows = qMin<int>(BLOCK_ROWS, m_rowCount - b * BLOCK_ROWS);
+    if (cache.file == m_id && cache.block == b && cache.rows == rows) {
+        return cache.offsets;
+    }
+
+    qint64 begin = m_marks.at(b);
+    qint64 end = b + 1 < m_marks.size() ? m_marks.at(b + 1) : m_indexed;
+
+    cache.offsets.resize(0);
+    cache.offsets.append(begin);
+    EndsBuilder builder(cache.offsets, begin);
+    CSV::tokenizeRows(m_data + begin, end - begin, builder, m_dialect);
+
+    cache.file = m_id;
+    cache.block = b;
+    cache.rows = rows;
+    return cache.offsets;
+}
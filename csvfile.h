@@ -0,0 +1,81 @@
+#ifndef CSVFILE_H
+#define CSVFILE_H
+
+#include <QFile>
+#include <QStringList>
+#include <QVector>
+
+#include "csvtokenizer.h"
+
+// A csv file opened through a memory mapping. open() only records where
+// rows start, fields are decoded on demand by row().
+//
+// Without an index, open() just maps the file. Rows can then be indexed
+// piece by piece: scanRows() only reads the mapping and may run on any
+// thread, appendRows() publishes its result.
+//
+// Only where every BLOCK_ROWS-th row starts is kept, so the index stays
+// small for files larger than memory. The rows of a block are found again
+// by tokenizing the block, every thread keeps the block it used last.
+//
+// A complete index can be saved next to the user's cache with saveIndex().
+// open() picks it up again as long as the file did not change, so the rows
+// need not be scanned again.
+class CsvFile
+{
+public:
+    enum { BLOCK_ROWS = 64 };
+
+    CsvFile();
+    ~CsvFile();
+
+    bool open(const QString &filename, bool index = true);
+    void close();
+
+    QString filename() const;
+    qint64 size() const;
+    const char * data() const;
+    int rowCount() const;
+    QStringList row(int r) const;
+    void rowFields(int r, QVector<CSV::Slice> &fields) const;
+
+    const CSV::Dialect & dialect() const;
+    // the line ending used most
+    QString crlf() const;
+
+    qint64 rowBegin(int r) const;
+    qint64 rowEnd(int r) const;
+    bool copy(qint64 begin, qint64 end, QIODevice * out) const;
+
+    qint64 indexed() const;
+    qint64 scanRows(qint64 from, qint64 length, QVector<qint64> &ends,
+                    CSV::LineEndings &endings) const;
+    void appendRows(const QVector<qint64> &ends, const CSV::LineEndings &endings);
+
+    bool saveIndex() const;
+
+private:
+    void _buildIndex();
+    bool _loadIndex();
+    QString _indexPath() const;
+    QByteArray _fingerprint() const;
+    const QVector<qint64> & _block(int b) const;
+
+private:
+    QFile m_file;
+    const char * m_data;
+    qint64 m_size;
+    // tells the row caches of different files apart
+    int m_id;
+
+    int m_rowCount;
+    // start of every BLOCK_ROWS-th row, beginning with the first one
+    QVector<qint64> m_marks;
+    // end of the last indexed row
+    qint64 m_indexed;
+
+    CSV::LineEndings m_endings;
+    CSV::Dialect m_dialect;
+};
+
+#endif // CSVFILE_H
@@ -0,0 +1,61 @@
+#include "csvloader.h"
+#include "csvfile.h"
+
+// batches start small so the first rows show up quickly, then grow
+static const qint64 FIRST_BATCH = 256 << 10;
+static const qint64 MAX_BATCH = 16 << 20;
+
+CsvLoader::CsvLoader(QObject * parent, QSharedPointer<CsvFile> file, int generation)
+    : QThread(parent), m_file(file), m_generation(generation)
+{
+    qRegisterMetaType<CsvBatch>("CsvBatch");
+}
+
+void CsvLoader::loadHead(CsvFile * file)
+{
+    qint64 from = file->indexed();
+    qint64 length = FIRST_BATCH;
+
+    // at least the header row
+    while (from < file->size()) {
+        CsvBatch batch;
+        length = qMin(length, file->size() - from);
+        qint64 next = file->scanRows(from, length, batch.ends, batch.endings);
+        file->appendRows(batch.ends, batch.endings);
+
+        if (next > from || from + length >= file->size())
+            break;
+        length *= 2;
+    }
+}
+
+void CsvLoader::run()
+{
+    // nothing else touches the index while we run, it only grows through
+    // the batches we send
+    qint64 from = m_file->indexed();
+    qint64 size = m_file->size();
+    qint64 length = FIRST_BATCH;
+
+    while (from < size && !isInterruptionRequested()) {
+        CsvBatch batch;
+        batch.generation = m_generation;
+        length = qMin(length, size - from);
+        qint64 next = m_file->scanRows(from, length, batch.ends, batch.endings);
+
+        if (next == from) {
+            // the rest is in an unterminated quote
+            if (from + length >= size)
+                break;
+            // a row longer than the batch
+            length *= 2;
+            continue;
+        }
+
+        from = next;
+        emit rowsLoaded(batch);
+        emit progress(from, size);
+
+        length = qMin(length * 2, MAX_BATCH);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef CSVLOADER_H
+#define CSVLOADER_H
+
+#include <QThread>
+#include <QSharedPointer>
+#include <QVector>
+
+#include "csvtokenizer.h"
+
+class CsvFile;
+
+struct CsvBatch
+{
+    CsvBatch() : generation(0) {}
+
+    QVector<qint64> ends;
+    CSV::LineEndings endings;
+    // the load the batch belongs to, batches of an older one are dropped
+    int generation;
+};
+
+Q_DECLARE_METATYPE(CsvBatch)
+
+// Indexes the rest of a mapped CsvFile on a worker thread. Rows are handed
+// to the GUI thread in batches through rowsLoaded(), which must call
+// CsvFile::appendRows() with them.
+class CsvLoader : public QThread
+{
+    Q_OBJECT
+
+public:
+    CsvLoader(QObject * parent, QSharedPointer<CsvFile> file, int generation);
+
+    // index the first rows on the calling thread, so there is something
+    // to show right away
+    static void loadHead(CsvFile * file);
+
+signals:
+    void rowsLoaded(CsvBatch batch);
+    void progress(qint64 done, qint64 total);
+
+protected:
+    void run();
+
+private:
+    QSharedPointer<CsvFile> m_file;
+    int m_generation;
+};
+
+#endif // CSVLOADER_H
@@ -0,0 +1,359 @@
+#ifndef CSVTOKENIZER_H
+#define CSVTOKENIZER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QtAlgorithms>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CSV_TOKENIZER_AVX2
+#define CSV_TOKENIZER_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CSV_TOKENIZER_SSE2
+#endif
+
+namespace CSV
+{
+    struct LineEndings
+    {
+        LineEndings() : crlf(0), lf(0), cr(0) {}
+
+        QString guess() const;
+
+        LineEndings &operator+=(const LineEndings &other);
+
+        qint64 crlf;
+        qint64 lf;
+        qint64 cr;
+    };
+
+    // How a file separates and quotes its fields, see sniff()
+    struct Dialect
+    {
+        Dialect() : delimiter(','), quote('"'), bom(0), codec("UTF-8"), crlf("\n") {}
+
+        char delimiter;
+        char quote;
+        // length of the byte order mark
+        int bom;
+        QByteArray codec;
+        QString crlf;
+    };
+
+    // Guesses the dialect from the first few hundred KB of a file: the byte
+    // order mark or encoding, then the delimiter (, ; tab or |) that splits
+    // rows most evenly, the quote character and the usual line ending.
+    Dialect sniff(const char * data, qint64 size);
+
+    // a field as reported by tokenize()
+    struct Slice
+    {
+        const char * begin;
+        const char * end;
+        bool escaped;
+    };
+
+    // decode a field that contains quotes or carriage returns
+    QString unescape(const char * begin, const char * end, char quote = '"');
+    void unescape(const char * begin, const char * end, QByteArray &value, char quote = '"');
+
+    // Cut data into about `count` pieces that each start at a row boundary,
+    // so they can be tokenized on different threads. The result holds the
+    // boundaries, including 0 and size.
+    QVector<qint64> splitRows(const char * data, qint64 size, int count, char quote);
+
+    namespace Detail
+    {
+        // the common dialects, with the characters known at compile time
+        template <char D, char Q>
+        struct FixedChars
+        {
+            char delimiter() const { return D; }
+            char quote() const { return Q; }
+        };
+
+        // any other dialect
+        struct RuntimeChars
+        {
+            explicit RuntimeChars(const Dialect &dialect)
+                : d(dialect.delimiter), q(dialect.quote)
+            {
+            }
+
+            char delimiter() const { return d; }
+            char quote() const { return q; }
+
+            char d;
+            char q;
+        };
+
+        // Scanners set bit i when p[i] is the delimiter or '\n', or the quote
+        // and '\r' when the data may hold them. There is one for every
+        // instruction set the build allows, tokenize() picks the widest.
+        struct ScalarScan
+        {
+            template <bool Quotes, bool CR, class Chars>
+            static quint64 scan64(const char * p, Chars chars)
+            {
+                quint64 mask = 0;
+                for (int i = 0; i < 64; ++i) {
+                    char c = p[i];
+                    if (c == chars.delimiter() || c == '\n' || (Quotes && c == chars.quote())
+                            || (CR && c == '\r')) {
+                        mask |= quint64(1) << i;
+                    }
+                }
+                return mask;
+            }
+        };
+
+#if defined(CSV_TOKENIZER_SSE2)
+        struct Sse2Scan
+        {
+            template <bool Quotes, bool CR, class Chars>
+            static quint64 scan64(const char * p, Chars chars)
+            {
+                const __m128i comma = _mm_set1_epi8(chars.delimiter());
+                const __m128i quote = _mm_set1_epi8(chars.quote());
+                const __m128i lf = _mm_set1_epi8('\n');
+                const __m128i cr = _mm_set1_epi8('\r');
+
+                quint64 mask = 0;
+                for (int i = 0; i < 64; i += 16) {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+                    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, lf));
+                    if (Quotes)
+                        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+                    if (CR)
+                        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, cr));
+                    mask |= quint64(quint32(_mm_movemask_epi8(m)) & 0xffff) << i;
+                }
+                return mask;
+            }
+        };
+#endif
+
+#if defined(CSV_TOKENIZER_AVX2)
+        struct Avx2Scan
+        {
+            template <bool Quotes, bool CR, class Chars>
+            static quint64 scan64(const char * p, Chars chars)
+            {
+                const __m256i comma = _mm256_set1_epi8(chars.delimiter());
+                const __m256i quote = _mm256_set1_epi8(chars.quote());
+                const __m256i lf = _mm256_set1_epi8('\n');
+                const __m256i cr = _mm256_set1_epi8('\r');
+
+                quint64 mask = 0;
+                for (int i = 0; i < 64; i += 32) {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+                    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, comma), _mm256_cmpeq_epi8(v, lf));
+                    if (Quotes)
+                        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quote));
+                    if (CR)
+                        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, cr));
+                    mask |= quint64(quint32(_mm256_movemask_epi8(m))) << i;
+                }
+                return mask;
+            }
+        };
+
+        typedef Avx2Scan BestScan;
+#elif defined(CSV_TOKENIZER_SSE2)
+        typedef Sse2Scan BestScan;
+#else
+        typedef ScalarScan BestScan;
+#endif
+
+        // Without Quotes the data must not hold the quote, without CR it
+        // must not hold '\r'; the work for them is then left out entirely.
+        template <class Scan, bool Quotes, bool CR, class Chars, class Handler>
+        void tokenize(const char * data, qint64 size, Handler &handler, Chars chars,
+                      LineEndings * endings)
+        {
+            bool quote = false;
+            bool escaped = false;
+            qint64 fieldBegin = 0;
+            qint64 rowBegin = 0;
+            qint64 skip = -1;
+
+            for (qint64 block = 0; block < size; block += 64) {
+                quint64 mask;
+                if (size - block >= 64) {
+                    mask = Scan::template scan64<Quotes, CR>(data + block, chars);
+                } else {
+                    char tail[64];
+                    memset(tail, 0, sizeof(tail));
+                    memcpy(tail, data + block, size - block);
+                    mask = Scan::template scan64<Quotes, CR>(tail, chars);
+                }
+
+                while (mask) {
+                    qint64 i = block + qCountTrailingZeroBits(mask);
+                    mask &= mask - 1;
+
+                    char current = data[i];
+
+                    if (endings) {
+                        if (current == '\n') {
+                            if (CR && i > 0 && data[i - 1] == '\r')
+                                endings->crlf += 1;
+                            else
+                                endings->lf += 1;
+                        } else if (CR && current == '\r') {
+                            if (i + 1 >= size || data[i + 1] != '\n')
+                                endings->cr += 1;
+                        }
+                    }
+
+                    if (Quotes && i == skip) {
+                        continue;
+                    }
+
+                    if (Quotes && quote) {
+                        if (current == chars.quote()) {
+                            // "" inside quotes is a literal quote
+                            if (i + 1 < size && data[i + 1] == chars.quote()) {
+                                skip = i + 1;
+                            } else {
+                                quote = false;
+                            }
+                        }
+                    } else if (current == chars.delimiter()) {
+                        handler.field(data + fieldBegin, data + i, escaped);
+                        fieldBegin = i + 1;
+                        escaped = false;
+                    } else if (current == '\n') {
+                        qint64 end = i;
+                        if (CR && end > fieldBegin && data[end - 1] == '\r') {
+                            end -= 1;
+                        }
+                        handler.field(data + fieldBegin, data + end, escaped);
+                        handler.row(i + 1);
+                        fieldBegin = rowBegin = i + 1;
+                        escaped = false;
+                    } else {
+                        // quote or a lone carriage return
+                        if (Quotes && current == chars.quote()) {
+                            quote = true;
+                        }
+                        escaped = true;
+                    }
+                }
+            }
+
+            if (!quote && rowBegin < size) {
+                handler.field(data + fieldBegin, data + size, escaped);
+                handler.row(size);
+            }
+        }
+
+        template <class Scan, class Chars, class Handler>
+        void tokenize(const char * data, qint64 size, Handler &handler, Chars chars,
+                      bool quotes, bool cr, LineEndings * endings)
+        {
+            if (quotes && cr)
+                tokenize<Scan, true, true>(data, size, handler, chars, endings);
+            else if (quotes)
+                tokenize<Scan, true, false>(data, size, handler, chars, endings);
+            else if (cr)
+                tokenize<Scan, false, true>(data, size, handler, chars, endings);
+            else
+                tokenize<Scan, false, false>(data, size, handler, chars, endings);
+        }
+
+        inline bool contains(const char * data, qint64 size, char c)
+        {
+            return size > 0 && memchr(data, c, size_t(size)) != nullptr;
+        }
+    }
+
+    // Split utf-8 csv data into fields, 64 bytes at a time. Only the
+    // positions of quotes, delimiters and line breaks are visited, fields
+    // are reported as slices of the input:
+    //
+    //   handler.field(begin, end, escaped)  escaped fields must go through
+    //                                       unescape(), others are verbatim
+    //   handler.row(end)                    the row ends before offset end
+    //
+    // The result is the same as the classic state machine run over the data
+    // with crlf replaced by lf: a missing final newline is implied, and a row
+    // left inside an unterminated quote is dropped.
+    //
+    // Comma, semicolon, tab and pipe with double quotes have their own
+    // compiled variants, as do data without quotes or carriage returns,
+    // which only look for delimiters and line feeds. Scan may name another
+    // scanner than the widest one, see Detail::BestScan.
+    template <class Scan = Detail::BestScan, class Handler>
+    void tokenize(const char * data, qint64 size, Handler &handler, const Dialect &dialect,
+                  LineEndings * endings = nullptr)
+    {
+        bool quotes = Detail::contains(data, size, dialect.quote);
+        bool cr = Detail::contains(data, size, '\r');
+
+        if (dialect.quote == '"') {
+            switch (dialect.delimiter) {
+            case ',':
+                Detail::tokenize<Scan>(data, size, handler, Detail::FixedChars<',', '"'>(), quotes, cr, endings);
+                return;
+            case ';':
+                Detail::tokenize<Scan>(data, size, handler, Detail::FixedChars<';', '"'>(), quotes, cr, endings);
+                return;
+            case '\t':
+                Detail::tokenize<Scan>(data, size, handler, Detail::FixedChars<'\t', '"'>(), quotes, cr, endings);
+                return;
+            case '|':
+                Detail::tokenize<Scan>(data, size, handler, Detail::FixedChars<'|', '"'>(), quotes, cr, endings);
+                return;
+            }
+        }
+        Detail::tokenize<Scan>(data, size, handler, Detail::RuntimeChars(dialect), quotes, cr, endings);
+    }
+
+    // The same as tokenize() for a handler that only wants handler.row().
+    // Data without quotes is cut at every line feed with memchr.
+    template <class Handler>
+    void tokenizeRows(const char * data, qint64 size, Handler &handler, const Dialect &dialect,
+                      LineEndings * endings = nullptr)
+    {
+        if (Detail::contains(data, size, dialect.quote)) {
+            tokenize(data, size, handler, dialect, endings);
+            return;
+        }
+
+        qint64 rowBegin = 0;
+        qint64 lines = 0;
+        qint64 crlf = 0;
+        while (rowBegin < size) {
+            const char * lf = static_cast<const char *>(
+                        memchr(data + rowBegin, '\n', size_t(size - rowBegin)));
+            if (!lf)
+                break;
+
+            qint64 i = lf - data;
+            lines += 1;
+            if (i > 0 && data[i - 1] == '\r')
+                crlf += 1;
+            handler.row(i + 1);
+            rowBegin = i + 1;
+        }
+        if (rowBegin < size) {
+            handler.row(size);
+        }
+
+        if (endings) {
+            qint64 crs = Detail::contains(data, size, '\r') ? std::count(data, data + size, '\r') : 0;
+            endings->crlf += crlf;
+            endings->lf += lines - crlf;
+            endings->cr += crs - crlf;
+        }
+    }
+}
+
+#endif // CSVTOKENIZER_H
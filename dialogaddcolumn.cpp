@@ -1,9 +1,13 @@
 #include "dialogaddcolumn.h"
 #include "ui_dialogaddcolumn.h"
+#include "expression.h"
+
+#include <QMessageBox>
 
 enum {
     INIT_EMPTY = 0,
     INIT_DUPLICATE = 1,
+    INIT_EXPRESSION = 2,
 };
 
 DialogAddColumn::DialogAddColumn(QWidget *parent, TableWidget * tw) :
@@ -15,6 +19,8 @@ DialogAddColumn::DialogAddColumn(QWidget *parent, TableWidget * tw) :
 
     ui->labelFrom->setVisible(false);
     ui->inputFrom->setVisible(false);
+    ui->labelExpression->setVisible(false);
+    ui->inputExpression->setVisible(false);
 
     for (int i = 0; i < m_tw->columnCount(); ++i) {
         ui->inputFrom->addItem(m_tw->header(i));
@@ -28,16 +34,27 @@ DialogAddColumn::~DialogAddColumn()
 
 void DialogAddColumn::accept()
 {
+    // compiled against the columns there are before this one
+    Expression expression;
+    if (ui->inputInit->currentIndex() == INIT_EXPRESSION) {
+        QStringList headers;
+        for (int i = 0; i < m_tw->columnCount(); ++i) {
+            headers << m_tw->header(i);
+        }
+        if (!expression.compile(ui->inputExpression->text(), headers)) {
+            QMessageBox::warning(this, "Add Column", expression.errorString());
+            return;
+        }
+    }
+
     TableWidgetTransaction ts(m_tw, "Add Column");
 
     int col = m_tw->addColumn(ui->inputHeader->text());
 
     if (ui->inputInit->currentIndex() == INIT_DUPLICATE) {
-        int src = ui->inputFrom->currentIndex();
-
-        for (int i = 0; i < m_tw->rowCount(); ++i) {
-            m_tw->setText(i, col, m_tw->text(i, src));
-        }
+        m_tw->copyColumn(ui->inputFrom->currentIndex(), col);
+    } else if (ui->inputInit->currentIndex() == INIT_EXPRESSION) {
+        m_tw->computeColumn(col, expression);
     }
 
     m_tw->resizeColumnToContents(col);
@@ -50,4 +67,8 @@ void DialogAddColumn::on_inputInit_currentIndexChanged(int index)
     bool showFrom = index == INIT_DUPLICATE;
     ui->labelFrom->setVisible(showFrom);
     ui->inputFrom->setVisible(showFrom);
+
+    bool showExpression = index == INIT_EXPRESSION;
+    ui->labelExpression->setVisible(showExpression);
+    ui->inputExpression->setVisible(showExpression);
 }
@@ -0,0 +1,69 @@
+#include "dialogfind.h"
+#include "ui_dialogfind.h"
+#include "finder.h"
+
+DialogFind::DialogFind(QWidget *parent, TableWidget * tw) :
+    QDialog(parent),
+    ui(new Ui::DialogFind),
+    m_tw(tw)
+{
+    ui->setupUi(this);
+}
+
+DialogFind::~DialogFind()
+{
+    delete ui;
+}
+
+void DialogFind::on_buttonFindNext_clicked()
+{
+    Finder finder = _finder();
+    if (!_checkFinder(finder))
+        return;
+
+    if (!m_tw->findNext(finder)) {
+        ui->labelStatus->setText("No match");
+    }
+}
+
+void DialogFind::on_buttonReplace_clicked()
+{
+    Finder finder = _finder();
+    if (!_checkFinder(finder))
+        return;
+
+    // replace the current cell when it matches, then go on to the next one
+    TableWidgetSelection sel = m_tw->selection();
+    if (sel.row >= 0 && sel.col >= 0) {
+        QString text = m_tw->text(sel.row, sel.col);
+        if (finder.matches(text)) {
+            TableWidgetTransaction ts(m_tw, "Replace");
+            m_tw->setText(sel.row, sel.col, finder.replace(text, ui->inputReplace->text()));
+        }
+    }
+
+    if (!m_tw->findNext(finder)) {
+        ui->labelStatus->setText("No match");
+    }
+}
+
+void DialogFind::on_buttonReplaceAll_clicked()
+{
+    Finder finder = _finder();
+    if (!_checkFinder(finder))
+        return;
+
+    int count = m_tw->replaceAll(finder, ui->inputReplace->text());
+    ui->labelStatus->setText(QString("Replaced %1 cells").arg(count));
+}
+
+Finder DialogFind::_finder()
+{
+    return Finder(ui->inputFind->text(), ui->checkRegex->isChecked(), ui->checkCase->isChecked());
+}
+
+bool DialogFind::_checkFinder(const Finder &finder)
+{
+    ui->labelStatus->setText(finder.errorString());
+    return finder.isValid();
+}
@@ -0,0 +1,35 @@
+#ifndef DIALOGFIND_H
+#define DIALOGFIND_H
+
+#include <QDialog>
+#include "tablewidget.h"
+
+namespace Ui {
+class DialogFind;
+}
+
+class Finder;
+
+class DialogFind : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit DialogFind(QWidget *parent, TableWidget * tw);
+    ~DialogFind();
+
+private slots:
+    void on_buttonFindNext_clicked();
+    void on_buttonReplace_clicked();
+    void on_buttonReplaceAll_clicked();
+
+private:
+    Finder _finder();
+    bool _checkFinder(const Finder &finder);
+
+private:
+    Ui::DialogFind *ui;
+    TableWidget * m_tw;
+};
+
+#endif // DIALOGFIND_H
@@ -0,0 +1,60 @@
+#include "dialogstorage.h"
+#include "ui_dialogstorage.h"
+#include "cellstore.h"
+
+#include <QLocale>
+
+namespace
+{
+    QString typeName(CellStore::Type type)
+    {
+        switch (type) {
+        case CellStore::Integer: return "Integer";
+        case CellStore::Decimal: return "Decimal";
+        case CellStore::Timestamp: return "Timestamp";
+        case CellStore::Dictionary: return "Dictionary";
+        default: return "Text";
+        }
+    }
+
+    QTableWidgetItem * numberItem(const QString &text)
+    {
+        QTableWidgetItem * item = new QTableWidgetItem(text);
+        item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+        return item;
+    }
+}
+
+DialogStorage::DialogStorage(QWidget *parent, TableWidget * tw) :
+    QDialog(parent),
+    ui(new Ui::DialogStorage),
+    m_tw(tw)
+{
+    ui->setupUi(this);
+
+    const CellStore &store = m_tw->store();
+    QLocale locale;
+
+    ui->tableColumns->setRowCount(store.columnCount());
+    for (int c = 0; c < store.columnCount(); ++c) {
+        CellStore::ColumnStats stats = store.columnStats(c);
+        bool dictionary = stats.type == CellStore::Dictionary;
+
+        QString hits;
+        if (dictionary && stats.lookups > 0) {
+            hits = QString("%1%").arg(100.0 * stats.hits / stats.lookups, 0, 'f', 1);
+        }
+
+        ui->tableColumns->setItem(c, 0, new QTableWidgetItem(store.header(c)));
+        ui->tableColumns->setItem(c, 1, new QTableWidgetItem(typeName(stats.type)));
+        ui->tableColumns->setItem(c, 2, numberItem(dictionary ? locale.toString(stats.distinct) : QString()));
+        ui->tableColumns->setItem(c, 3, numberItem(hits));
+        ui->tableColumns->setItem(c, 4, numberItem(QString("%1 KB").arg(locale.toString((stats.bytes + 1023) / 1024))));
+    }
+    ui->tableColumns->resizeColumnsToContents();
+}
+
+DialogStorage::~DialogStorage()
+{
+    delete ui;
+}
@@ -0,0 +1,26 @@
+#ifndef DIALOGSTORAGE_H
+#define DIALOGSTORAGE_H
+
+#include <QDialog>
+#include "tablewidget.h"
+
+namespace Ui {
+class DialogStorage;
+}
+
+// How every column is kept in memory, and how well dictionary columns
+// find their values
+class DialogStorage : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit DialogStorage(QWidget *parent, TableWidget * tw);
+    ~DialogStorage();
+
+private:
+    Ui::DialogStorage *ui;
+    TableWidget * m_tw;
+};
+
+#endif // DIALOGSTORAGE_H
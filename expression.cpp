@@ -0,0 +1,709 @@
+#include "expression.h"
+#include "cellstore.h"
+#include "csv.h"
+#include "exprlexer.h"
+
+#include <QtConcurrent>
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// rows evaluated by one task
+static const int BLOCK_ROWS = 16384;
+
+namespace
+{
+    enum ValueType {
+        NUMBER,
+        TEXT,
+    };
+
+    enum Op {
+        NEG,
+        NOT,
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        MOD,
+        EQ,
+        NE,
+        LT,
+        LE,
+        GT,
+        GE,
+        CONTAINS,
+        AND,
+        OR,
+        IF,
+        SUBSTR,
+        LEN,
+        UPPER,
+        LOWER,
+        TRIM,
+        CONCAT,
+        ROUND,
+        ABS,
+    };
+
+    struct Function
+    {
+        const char * name;
+        Op op;
+        int minArgs;
+        int maxArgs;
+        ValueType type;
+    };
+
+    const Function FUNCTIONS[] = {
+        { "if", IF, 3, 3, TEXT },
+        { "substr", SUBSTR, 2, 3, TEXT },
+        { "len", LEN, 1, 1, NUMBER },
+        { "upper", UPPER, 1, 1, TEXT },
+        { "lower", LOWER, 1, 1, TEXT },
+        { "trim", TRIM, 1, 1, TEXT },
+        { "concat", CONCAT, 1, 64, TEXT },
+        { "round", ROUND, 1, 2, NUMBER },
+        { "abs", ABS, 1, 1, NUMBER },
+    };
+
+    const double EMPTY = std::numeric_limits<double>::quiet_NaN();
+
+    bool isAscii(const QByteArray &text)
+    {
+        for (int i = 0; i < text.size(); ++i) {
+            if (uchar(text[i]) >= 0x80)
+                return false;
+        }
+        return true;
+    }
+
+    // a position or length for mid(), also from huge or infinite numbers
+    int toCount(double value)
+    {
+        return int(qBound(0.0, value, double(INT_MAX)));
+    }
+
+    QByteArray formatNumber(double value)
+    {
+        if (std::isnan(value) || std::isinf(value))
+            return QByteArray();
+        if (value == std::floor(value) && std::fabs(value) < 1e15)
+            return QByteArray::number(qint64(value));
+        return QByteArray::number(value, 'g', 15);
+    }
+
+    // compares like a RowFilter: as numbers when both sides are numbers
+    int compareTexts(const QByteArray &a, const QByteArray &b)
+    {
+        double na, nb;
+        if (CSV::toNumber(a.constData(), a.size(), na) && CSV::toNumber(b.constData(), b.size(), nb))
+            return na < nb ? -1 : (na > nb ? 1 : 0);
+
+        int cmp = memcmp(a.constData(), b.constData(), qMin(a.size(), b.size()));
+        return cmp != 0 ? cmp : a.size() - b.size();
+    }
+
+    bool truth(double value)
+    {
+        return !std::isnan(value) && value != 0;
+    }
+}
+
+struct Expression::Node
+{
+    enum Kind {
+        COLUMN,
+        LITERAL,
+        APPLY,
+    };
+
+    Kind kind;
+    ValueType type;
+
+    int column;
+    double number;
+    QByteArray text;
+
+    Op op;
+    QVector<QSharedPointer<Node> > args;
+};
+
+namespace
+{
+    typedef QSharedPointer<Expression::Node> NodePtr;
+
+    class Parser
+    {
+    public:
+        Parser(const QString &expr, const QStringList &headers)
+            : m_lexer(expr, false), m_headers(headers)
+        {
+        }
+
+        NodePtr parse() {
+            _next();
+            NodePtr node = _parseOr();
+            if (node && m_lexer.type() != ExprLexer::END) {
+                _fail("Unexpected " + m_lexer.token());
+            }
+            return m_error.isEmpty() ? node : NodePtr();
+        }
+
+        QString error() const {
+            return m_error;
+        }
+
+    private:
+        NodePtr _parseOr() {
+            NodePtr node = _parseAnd();
+            while (node && _isOp("||")) {
+                _next();
+                node = _apply(OR, NUMBER, node, _parseAnd());
+            }
+            return node;
+        }
+
+        NodePtr _parseAnd() {
+            NodePtr node = _parseCompare();
+            while (node && _isOp("&&")) {
+                _next();
+                node = _apply(AND, NUMBER, node, _parseCompare());
+            }
+            return node;
+        }
+
+        NodePtr _parseCompare() {
+            NodePtr node = _parseSum();
+            if (!node)
+                return node;
+
+            static const char * const ops[] = { "==", "!=", "<", "<=", ">", ">=", "~" };
+            for (int i = 0; m_lexer.type() == ExprLexer::OP && i < 7; ++i) {
+                if (m_lexer.token() == ops[i]) {
+                    _next();
+                    return _apply(Op(EQ + i), NUMBER, node, _parseSum());
+                }
+            }
+            return node;
+        }
+
+        NodePtr _parseSum() {
+            NodePtr node = _parseProduct();
+            while (node && (_isOp("+") || _isOp("-"))) {
+                Op op = _isOp("+") ? ADD : SUB;
+                _next();
+                node = _apply(op, NUMBER, node, _parseProduct());
+            }
+            return node;
+        }
+
+        NodePtr _parseProduct() {
+            NodePtr node = _parseUnary();
+            while (node && (_isOp("*") || _isOp("/") || _isOp("%"))) {
+                Op op = _isOp("*") ? MUL : (_isOp("/") ? DIV : MOD);
+                _next();
+                node = _apply(op, NUMBER, node, _parseUnary());
+            }
+            return node;
+        }
+
+        NodePtr _parseUnary() {
+            if (_isOp("-") || _isOp("!")) {
+                Op op = _isOp("-") ? NEG : NOT;
+                _next();
+                return _apply(op, NUMBER, _parseUnary(), NodePtr());
+            }
+            return _parsePrimary();
+        }
+
+        NodePtr _parsePrimary() {
+            NodePtr node(new Expression::Node);
+            node->column = -1;
+            node->number = EMPTY;
+
+            if (_isOp("(")) {
+                _next();
+                node = _parseOr();
+                if (node && !_isOp(")")) {
+                    return _fail("Missing )");
+                }
+                _next();
+                return node;
+            }
+
+            if (m_lexer.type() == ExprLexer::NAME && !m_lexer.quoted() && m_lexer.peek() == '(') {
+                return _parseCall();
+            }
+
+            if (m_lexer.type() == ExprLexer::NAME) {
+                node->kind = Expression::Node::COLUMN;
+                node->type = TEXT;
+                node->column = m_headers.indexOf(m_lexer.token());
+                if (node->column < 0) {
+                    return _fail("Unknown column " + m_lexer.token());
+                }
+            } else if (m_lexer.type() == ExprLexer::STRING || m_lexer.type() == ExprLexer::NUMBER) {
+                node->kind = Expression::Node::LITERAL;
+                node->type = m_lexer.type() == ExprLexer::NUMBER ? NUMBER : TEXT;
+                node->text = m_lexer.token().toUtf8();
+                if (!CSV::toNumber(node->text.constData(), node->text.size(), node->number)) {
+                    if (m_lexer.type() == ExprLexer::NUMBER) {
+                        return _fail("Bad number " + m_lexer.token());
+                    }
+                    node->number = EMPTY;
+                }
+            } else {
+                return _fail(m_lexer.type() == ExprLexer::END ? QString("Unexpected end") : "Unexpected " + m_lexer.token());
+            }
+            _next();
+            return node;
+        }
+
+        NodePtr _parseCall() {
+            QString name = m_lexer.token();
+            const Function * function = nullptr;
+            for (size_t i = 0; i < sizeof(FUNCTIONS) / sizeof(FUNCTIONS[0]); ++i) {
+                if (name.compare(FUNCTIONS[i].name, Qt::CaseInsensitive) == 0)
+                    function = &FUNCTIONS[i];
+            }
+            if (!function) {
+                return _fail("Unknown function " + name);
+            }
+
+            NodePtr node(new Expression::Node);
+            node->kind = Expression::Node::APPLY;
+            node->type = function->type;
+            node->column = -1;
+            node->number = EMPTY;
+            node->op = function->op;
+
+            _next();
+            _next();
+            while (!_isOp(")")) {
+                NodePtr arg = _parseOr();
+                if (!arg)
+                    return NodePtr();
+                node->args.append(arg);
+
+                if (_isOp(","))
+                    _next();
+                else if (!_isOp(")"))
+                    return _fail("Expected , or ) after " + m_lexer.last());
+            }
+            _next();
+
+            if (node->args.size() < function->minArgs || node->args.size() > function->maxArgs) {
+                return _fail(QString("Wrong number of arguments to %1").arg(name));
+            }
+
+            // if gives numbers when both of its branches do
+            if (node->op == IF && node->args[1]->type == NUMBER && node->args[2]->type == NUMBER) {
+                node->type = NUMBER;
+            }
+            return node;
+        }
+
+        NodePtr _apply(Op op, ValueType type, NodePtr left, NodePtr right) {
+            if (!left || (op != NEG && op != NOT && !right))
+                return NodePtr();
+
+            NodePtr node(new Expression::Node);
+            node->kind = Expression::Node::APPLY;
+            node->type = type;
+            node->column = -1;
+            node->number = EMPTY;
+            node->op = op;
+            node->args.append(left);
+            if (right)
+                node->args.append(right);
+            return node;
+        }
+
+        bool _isOp(const char * op) const {
+            return m_lexer.isOp(op);
+        }
+
+        NodePtr _fail(const QString &error) {
+            if (m_error.isEmpty())
+                m_error = error;
+            return NodePtr();
+        }
+
+        void _next() {
+            m_lexer.next();
+            if (!m_lexer.errorString().isEmpty()) {
+                _fail(m_lexer.errorString());
+            }
+        }
+
+    private:
+        ExprLexer m_lexer;
+        QStringList m_headers;
+        QString m_error;
+    };
+
+    void evaluateTexts(const Expression::Node * node, const CellStore &store,
+                       int begin, int end, QVector<QByteArray> &out);
+
+    // out[i] is the value for row begin + i, NaN when it is empty
+    void evaluateNumbers(const Expression::Node * node, const CellStore &store,
+                         int begin, int end, QVector<double> &out)
+    {
+        int count = end - begin;
+        out.resize(count);
+
+        if (node->kind == Expression::Node::LITERAL) {
+            out.fill(node->number);
+            return;
+        }
+
+        if (node->kind == Expression::Node::COLUMN) {
+            // numbers of a typed column are read as they are
+            CellStore::Type type = store.columnType(node->column);
+            if (type == CellStore::Integer || type == CellStore::Decimal) {
+                for (int r = begin; r < end; ++r) {
+                    if (!store.number(r, node->column, out[r - begin]))
+                        out[r - begin] = EMPTY;
+                }
+                return;
+            }
+
+            QVector<int> columns;
+            columns << node->column;
+            store.visitCells(begin, end, columns,
+                             [&](int r, int, const char * data, int length) {
+                double &value = out[r - begin];
+                if (!CSV::toNumber(data, length, value))
+                    value = EMPTY;
+            });
+            return;
+        }
+
+        if (node->type == TEXT) {
+            QVector<QByteArray> texts;
+            evaluateTexts(node, store, begin, end, texts);
+            for (int i = 0; i < count; ++i) {
+                if (!CSV::toNumber(texts[i].constData(), texts[i].size(), out[i]))
+                    out[i] = EMPTY;
+            }
+            return;
+        }
+
+        const Expression::Node * a = node->args.value(0).data();
+        const Expression::Node * b = node->args.value(1).data();
+
+        switch (node->op) {
+        case NEG:
+        case NOT:
+        case ABS:
+            evaluateNumbers(a, store, begin, end, out);
+            for (int i = 0; i < count; ++i) {
+                if (node->op == NOT)
+                    out[i] = truth(out[i]) ? 0 : 1;
+                else
+                    out[i] = node->op == NEG ? -out[i] : std::fabs(out[i]);
+            }
+            return;
+
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case MOD: {
+            QVector<double> right;
+            evaluateNumbers(a, store, begin, end, out);
+            evaluateNumbers(b, store, begin, end, right);
+
+            // NaN stays NaN, so empty cells give empty results
+            switch (node->op) {
+            case ADD:
+                for (int i = 0; i < count; ++i) out[i] += right[i];
+                break;
+            case SUB:
+                for (int i = 0; i < count; ++i) out[i] -= right[i];
+                break;
+            case MUL:
+                for (int i = 0; i < count; ++i) out[i] *= right[i];
+                break;
+            case DIV:
+                for (int i = 0; i < count; ++i) out[i] = right[i] != 0 ? out[i] / right[i] : EMPTY;
+                break;
+            default:
+                for (int i = 0; i < count; ++i) out[i] = right[i] != 0 ? std::fmod(out[i], right[i]) : EMPTY;
+                break;
+            }
+            return;
+        }
+
+        case AND:
+        case OR: {
+            QVector<double> right;
+            evaluateNumbers(a, store, begin, end, out);
+            evaluateNumbers(b, store, begin, end, right);
+            for (int i = 0; i < count; ++i) {
+                bool value = node->op == AND ? truth(out[i]) && truth(right[i])
+                                             : truth(out[i]) || truth(right[i]);
+                out[i] = value ? 1 : 0;
+            }
+            return;
+        }
+
+        case EQ:
+        case NE:
+        case LT:
+        case LE:
+        case GT:
+        case GE:
+        case CONTAINS: {
+            // against a number both sides are numbers, anything that is
+            // not one never matches
+            if (node->op != CONTAINS && (a->type == NUMBER || b->type == NUMBER)) {
+                QVector<double> right;
+                evaluateNumbers(a, store, begin, end, out);
+                evaluateNumbers(b, store, begin, end, right);
+                for (int i = 0; i < count; ++i) {
+                    double x = out[i];
+                    double y = right[i];
+                    bool value;
+                    switch (node->op) {
+                    case EQ: value = x == y; break;
+                    case NE: value = !(x == y); break;
+                    case LT: value = x < y; break;
+                    case LE: value = x <= y; break;
+                    case GT: value = x > y; break;
+                    default: value = x >= y; break;
+                    }
+                    out[i] = value ? 1 : 0;
+                }
+                return;
+            }
+
+            QVector<QByteArray> left, right;
+            evaluateTexts(a, store, begin, end, left);
+            evaluateTexts(b, store, begin, end, right);
+            for (int i = 0; i < count; ++i) {
+                bool value;
+                if (node->op == CONTAINS) {
+                    value = left[i].contains(right[i]);
+                } else {
+                    int cmp = compareTexts(left[i], right[i]);
+                    switch (node->op) {
+                    case EQ: value = cmp == 0; break;
+                    case NE: value = cmp != 0; break;
+                    case LT: value = cmp < 0; break;
+                    case LE: value = cmp <= 0; break;
+                    case GT: value = cmp > 0; break;
+                    default: value = cmp >= 0; break;
+                    }
+                }
+                out[i] = value ? 1 : 0;
+            }
+            return;
+        }
+
+        case IF: {
+            QVector<double> yes, no;
+            evaluateNumbers(a, store, begin, end, out);
+            evaluateNumbers(node->args[1].data(), store, begin, end, yes);
+            evaluateNumbers(node->args[2].data(), store, begin, end, no);
+            for (int i = 0; i < count; ++i) {
+                out[i] = truth(out[i]) ? yes[i] : no[i];
+            }
+            return;
+        }
+
+        case LEN: {
+            QVector<QByteArray> texts;
+            evaluateTexts(a, store, begin, end, texts);
+            for (int i = 0; i < count; ++i) {
+                out[i] = isAscii(texts[i]) ? texts[i].size()
+                                           : QString::fromUtf8(texts[i]).size();
+            }
+            return;
+        }
+
+        case ROUND: {
+            QVector<double> places;
+            evaluateNumbers(a, store, begin, end, out);
+            if (b)
+                evaluateNumbers(b, store, begin, end, places);
+            for (int i = 0; i < count; ++i) {
+                double scale = b ? std::pow(10.0, std::floor(places[i])) : 1;
+                out[i] = std::round(out[i] * scale) / scale;
+            }
+            return;
+        }
+
+        default:
+            out.fill(EMPTY);
+            return;
+        }
+    }
+
+    void evaluateTexts(const Expression::Node * node, const CellStore &store,
+                       int begin, int end, QVector<QByteArray> &out)
+    {
+        int count = end - begin;
+        out.resize(count);
+
+        if (node->kind == Expression::Node::LITERAL) {
+            out.fill(node->text);
+            return;
+        }
+
+        if (node->kind == Expression::Node::COLUMN) {
+            QVector<int> columns;
+            columns << node->column;
+            store.visitCells(begin, end, columns,
+                             [&](int r, int, const char * data, int length) {
+                out[r - begin] = QByteArray(data, length);
+            });
+            return;
+        }
+
+        if (node->type == NUMBER) {
+            QVector<double> numbers;
+            evaluateNumbers(node, store, begin, end, numbers);
+            for (int i = 0; i < count; ++i) {
+                out[i] = formatNumber(numbers[i]);
+            }
+            return;
+        }
+
+        const Expression::Node * a = node->args.value(0).data();
+
+        switch (node->op) {
+        case IF: {
+            QVector<double> cond;
+            QVector<QByteArray> no;
+            evaluateNumbers(a, store, begin, end, cond);
+            evaluateTexts(node->args[1].data(), store, begin, end, out);
+            evaluateTexts(node->args[2].data(), store, begin, end, no);
+            for (int i = 0; i < count; ++i) {
+                if (!truth(cond[i]))
+                    out[i] = no[i];
+            }
+            return;
+        }
+
+        case SUBSTR: {
+            // positions count characters from 0
+            QVector<double> from, length;
+            evaluateTexts(a, store, begin, end, out);
+            evaluateNumbers(node->args[1].data(), store, begin, end, from);
+            if (node->args.size() > 2)
+                evaluateNumbers(node->args[2].data(), store, begin, end, length);
+            for (int i = 0; i < count; ++i) {
+                int pos = std::isnan(from[i]) ? 0 : toCount(from[i]);
+                int n = length.isEmpty() || std::isnan(length[i]) ? -1 : toCount(length[i]);
+                if (isAscii(out[i]))
+                    out[i] = out[i].mid(pos, n);
+                else
+                    out[i] = QString::fromUtf8(out[i]).mid(pos, n).toUtf8();
+            }
+            return;
+        }
+
+        case UPPER:
+        case LOWER:
+            evaluateTexts(a, store, begin, end, out);
+            for (int i = 0; i < count; ++i) {
+                if (isAscii(out[i]))
+                    out[i] = node->op == UPPER ? out[i].toUpper() : out[i].toLower();
+                else if (node->op == UPPER)
+                    out[i] = QString::fromUtf8(out[i]).toUpper().toUtf8();
+                else
+                    out[i] = QString::fromUtf8(out[i]).toLower().toUtf8();
+            }
+            return;
+
+        case TRIM:
+            evaluateTexts(a, store, begin, end, out);
+            for (int i = 0; i < count; ++i) {
+                out[i] = out[i].trimmed();
+            }
+            return;
+
+        case CONCAT: {
+            evaluateTexts(a, store, begin, end, out);
+            QVector<QByteArray> more;
+            for (int k = 1; k < node->args.size(); ++k) {
+                evaluateTexts(node->args[k].data(), store, begin, end, more);
+                for (int i = 0; i < count; ++i) {
+                    out[i] += more[i];
+                }
+            }
+            return;
+        }
+
+        default:
+            out.fill(QByteArray());
+            return;
+        }
+    }
+
+    struct Block
+    {
+        int begin;
+        int end;
+        QVector<QByteArray> texts;
+    };
+}
+
+Expression::Expression()
+{
+}
+
+bool Expression::compile(const QString &expr, const QStringList &headers)
+{
+    Parser parser(expr, headers);
+    m_root = parser.parse();
+    m_error = parser.error();
+    return !m_root.isNull();
+}
+
+QString Expression::errorString() const
+{
+    return m_error;
+}
+
+CellGrid Expression::evaluate(const CellStore &store) const
+{
+    CellGrid grid;
+    if (!m_root)
+        return grid;
+
+    QVector<Block> blocks;
+    for (int r = 0; r < store.rowCount(); r += BLOCK_ROWS) {
+        Block block;
+        block.begin = r;
+        block.end = qMin(r + BLOCK_ROWS, store.rowCount());
+        blocks.append(block);
+    }
+
+    const Node * root = m_root.data();
+    QtConcurrent::blockingMap(blocks, [root, &store](Block &block) {
+        evaluateTexts(root, store, block.begin, block.end, block.texts);
+    });
+
+    qint64 bytes = 0;
+    foreach (const Block &block, blocks) {
+        foreach (const QByteArray &text, block.texts) {
+            bytes += text.size();
+        }
+    }
+
+    grid.reserve(int(qMin<qint64>(bytes, INT_MAX)));
+    for (int k = 0; k < blocks.size(); ++k) {
+        foreach (const QByteArray &text, blocks[k].texts) {
+            grid.addRow();
+            grid.addCell(text.constData(), text.size());
+        }
+        // the texts of a block are not needed once they are in the grid
+        blocks[k].texts.clear();
+    }
+    return grid;
+}
@@ -0,0 +1,42 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <QSharedPointer>
+#include <QStringList>
+
+class CellStore;
+class CellGrid;
+
+// Computes a value for every row from its columns, such as
+//
+//   price * qty
+//   substr(host, 0, 5)
+//   if(status == "OK", 1, 0)
+//
+// Columns and literals are written as in a RowFilter. On top of its
+// comparisons and && || ! there are + - * / %, and the functions if,
+// substr, len, upper, lower, trim, concat, round and abs. Arithmetic reads
+// columns as numbers, an empty cell or text gives an empty result.
+//
+// The expression is compiled once into a tree whose nodes know whether
+// they give numbers or text. It is evaluated one node at a time over a
+// whole block of rows, blocks run on all cores.
+class Expression
+{
+public:
+    Expression();
+
+    bool compile(const QString &expr, const QStringList &headers);
+    QString errorString() const;
+
+    // one cell for every row of the store, in order
+    CellGrid evaluate(const CellStore &store) const;
+
+    struct Node;
+
+private:
+    QSharedPointer<Node> m_root;
+    QString m_error;
+};
+
+#endif // EXPRESSION_H
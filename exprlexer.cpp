@@ -0,0 +1,107 @@
+#include "exprlexer.h"
+
+ExprLexer::ExprLexer(const QString &expr, bool signedNumbers)
+    : m_expr(expr), m_signedNumbers(signedNumbers), m_pos(0), m_type(END), m_quoted(false)
+{
+}
+
+void ExprLexer::next()
+{
+    m_last = m_token;
+    m_quoted = false;
+
+    while (m_pos < m_expr.size() && m_expr[m_pos].isSpace())
+        ++m_pos;
+
+    m_token.clear();
+    if (m_pos >= m_expr.size()) {
+        m_type = END;
+        return;
+    }
+
+    QChar c = m_expr[m_pos];
+    if (c.isLetter() || c == '_') {
+        m_type = NAME;
+        while (m_pos < m_expr.size() && (m_expr[m_pos].isLetterOrNumber()
+                || m_expr[m_pos] == '_' || m_expr[m_pos] == '.')) {
+            m_token += m_expr[m_pos++];
+        }
+    } else if (c == '`' || c == '"' || c == '\'') {
+        // quoted column name or string, a backslash escapes the next
+        // character
+        m_type = c == '`' ? NAME : STRING;
+        m_quoted = true;
+        ++m_pos;
+        while (m_pos < m_expr.size() && m_expr[m_pos] != c) {
+            if (m_expr[m_pos] == '\\' && m_pos + 1 < m_expr.size())
+                ++m_pos;
+            m_token += m_expr[m_pos++];
+        }
+        if (m_pos >= m_expr.size() && m_error.isEmpty()) {
+            m_error = "Missing closing " + QString(c);
+        }
+        ++m_pos;
+    } else if (c.isDigit() || c == '.' || (m_signedNumbers && c == '-')) {
+        m_type = NUMBER;
+        m_token += m_expr[m_pos++];
+        while (m_pos < m_expr.size() && (m_expr[m_pos].isDigit() || m_expr[m_pos] == '.'
+                || m_expr[m_pos] == 'e' || m_expr[m_pos] == 'E'
+                || ((m_expr[m_pos] == '-' || m_expr[m_pos] == '+')
+                    && (m_expr[m_pos - 1] == 'e' || m_expr[m_pos - 1] == 'E')))) {
+            m_token += m_expr[m_pos++];
+        }
+    } else {
+        m_type = OP;
+        static const char * const ops[] = { "==", "!=", "<=", ">=", "&&", "||" };
+        for (int i = 0; i < 6; ++i) {
+            if (m_expr.midRef(m_pos, 2) == QLatin1String(ops[i])) {
+                m_token = ops[i];
+                m_pos += 2;
+                return;
+            }
+        }
+        m_token = c;
+        m_pos += 1;
+        // a single = means the same as ==
+        if (m_token == "=")
+            m_token = "==";
+    }
+}
+
+ExprLexer::Type ExprLexer::type() const
+{
+    return m_type;
+}
+
+const QString & ExprLexer::token() const
+{
+    return m_token;
+}
+
+const QString & ExprLexer::last() const
+{
+    return m_last;
+}
+
+bool ExprLexer::quoted() const
+{
+    return m_quoted;
+}
+
+bool ExprLexer::isOp(const char * op) const
+{
+    return m_type == OP && m_token == op;
+}
+
+QChar ExprLexer::peek() const
+{
+    int pos = m_pos;
+    while (pos < m_expr.size() && m_expr[pos].isSpace())
+        ++pos;
+    return pos < m_expr.size() ? m_expr[pos] : QChar();
+}
+
+QString ExprLexer::errorString() const
+{
+    return m_error;
+}
@@ -0,0 +1,52 @@
+#ifndef EXPRLEXER_H
+#define EXPRLEXER_H
+
+#include <QString>
+
+// Splits a RowFilter or Expression into tokens: names, in backquotes when
+// they are not plain identifiers, strings in double or single quotes where
+// a backslash escapes the next character, numbers and operators. A single
+// = is read as ==.
+class ExprLexer
+{
+public:
+    enum Type {
+        END,
+        NAME,
+        STRING,
+        NUMBER,
+        OP,
+    };
+
+    // with signedNumbers a minus starts a number, otherwise it is an
+    // operator and a - 1 is a subtraction
+    ExprLexer(const QString &expr, bool signedNumbers);
+
+    void next();
+
+    Type type() const;
+    const QString & token() const;
+    // the token before this one
+    const QString & last() const;
+    // a name or string that was written in quotes
+    bool quoted() const;
+    bool isOp(const char * op) const;
+    // the next character that is not a space
+    QChar peek() const;
+
+    // set once a quote was not closed
+    QString errorString() const;
+
+private:
+    QString m_expr;
+    bool m_signedNumbers;
+    int m_pos;
+
+    Type m_type;
+    bool m_quoted;
+    QString m_token;
+    QString m_last;
+    QString m_error;
+};
+
+#endif // EXPRLEXER_H
@@ -0,0 +1,140 @@
+#include "finder.h"
+#include "cellstore.h"
+
+#include <QtConcurrent>
+
+// rows searched by one task
+static const int BLOCK_ROWS = 16384;
+
+// find next searches this many rows first, then twice as many each time
+static const int FIRST_WINDOW = 1 << 16;
+static const int MAX_WINDOW = 1 << 22;
+
+namespace
+{
+    struct Block
+    {
+        int begin;
+        int end;
+        QVector<QPoint> hits;
+    };
+}
+
+Finder::Finder(const QString &text, bool regex, bool caseSensitive)
+    : m_text(text)
+    , m_regex(regex)
+    , m_cs(caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive)
+{
+    if (m_regex) {
+        m_re.setPattern(text);
+        if (!caseSensitive) {
+            m_re.setPatternOptions(QRegularExpression::CaseInsensitiveOption);
+        }
+        m_re.optimize();
+        return;
+    }
+
+    // quotes are doubled and line breaks may be crlf in the file, and
+    // letters can differ in case, the raw bytes only help without those
+    bool verbatim = !text.contains('"') && !text.contains('\n') && !text.contains('\r');
+    bool caseless = caseSensitive || text.toLower() == text.toUpper();
+    if (verbatim && caseless) {
+        m_raw = text.toUtf8();
+    }
+}
+
+bool Finder::isValid() const
+{
+    if (m_regex) {
+        return m_re.isValid();
+    }
+    return !m_text.isEmpty();
+}
+
+QString Finder::errorString() const
+{
+    if (m_regex && !m_re.isValid()) {
+        return m_re.errorString();
+    }
+    return QString();
+}
+
+bool Finder::matches(const QString &text) const
+{
+    if (m_regex) {
+        return m_re.match(text).hasMatch();
+    }
+    return text.contains(m_text, m_cs);
+}
+
+QString Finder::replace(QString text, const QString &with) const
+{
+    if (m_regex) {
+        return text.replace(m_re, with);
+    }
+    return text.replace(m_text, with, m_cs);
+}
+
+QVector<QPoint> Finder::findAll(const CellStore &store) const
+{
+    return _find(store, 0, store.rowCount());
+}
+
+bool Finder::findNext(const CellStore &store, int &row, int &col) const
+{
+    int rows = store.rowCount();
+    if (!isValid() || rows == 0) {
+        return false;
+    }
+
+    int startRow = qBound(0, row, rows - 1);
+    int startCol = row < 0 ? -1 : col;
+    int window = FIRST_WINDOW;
+
+    // the rest of the table first, then from the top down to where we are
+    for (int pass = 0; pass < 2; ++pass) {
+        int from = pass == 0 ? startRow : 0;
+        int to = pass == 0 ? rows : startRow + 1;
+
+        for (int begin = from; begin < to; begin += window, window = qMin(window * 2, MAX_WINDOW)) {
+            QVector<QPoint> hits = _find(store, begin, qMin(begin + window, to));
+            foreach (const QPoint &hit, hits) {
+                if (pass == 1 || hit.y() > startRow || hit.x() > startCol) {
+                    row = hit.y();
+                    col = hit.x();
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+QVector<QPoint> Finder::_find(const CellStore &store, int begin, int end) const
+{
+    QVector<QPoint> hits;
+    if (!isValid()) {
+        return hits;
+    }
+
+    QVector<Block> blocks;
+    for (int r = begin; r < end; r += BLOCK_ROWS) {
+        Block block;
+        block.begin = r;
+        block.end = qMin(r + BLOCK_ROWS, end);
+        blocks.append(block);
+    }
+
+    std::function<bool (const QString &)> match = [this](const QString &text) {
+        return matches(text);
+    };
+
+    QtConcurrent::blockingMap(blocks, [&store, &match, this](Block &block) {
+        store.findInRows(block.begin, block.end, m_raw, match, block.hits);
+    });
+
+    foreach (const Block &block, blocks) {
+        hits += block.hits;
+    }
+    return hits;
+}
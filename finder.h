@@ -0,0 +1,42 @@
+#ifndef FINDER_H
+#define FINDER_H
+
+#include <QPoint>
+#include <QRegularExpression>
+#include <QVector>
+
+class CellStore;
+
+// Finds cells by substring or regular expression. A search runs over
+// blocks of rows on all cores, and rows of an attached file are first
+// checked on their raw bytes, so mostly only rows that match get decoded.
+class Finder
+{
+public:
+    Finder(const QString &text, bool regex, bool caseSensitive);
+
+    bool isValid() const;
+    QString errorString() const;
+
+    bool matches(const QString &text) const;
+    QString replace(QString text, const QString &with) const;
+
+    // matching cells as (column, row), row by row
+    QVector<QPoint> findAll(const CellStore &store) const;
+    // the first match after the cell at (row, col), wrapping around
+    bool findNext(const CellStore &store, int &row, int &col) const;
+
+private:
+    QVector<QPoint> _find(const CellStore &store, int begin, int end) const;
+
+private:
+    QString m_text;
+    bool m_regex;
+    Qt::CaseSensitivity m_cs;
+    QRegularExpression m_re;
+
+    // bytes every match holds verbatim in the file, empty when unknown
+    QByteArray m_raw;
+};
+
+#endif // FINDER_H
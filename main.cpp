@@ -1,10 +1,21 @@
 #include "mainwindow.h"
+#include "batchjob.h"
 #include <QApplication>
 #include <QCommandLineParser>
 #include <QDebug>
 
 int main(int argc, char *argv[])
 {
+    // scripted runs get no gui at all, so they work on headless servers
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--batch") == 0) {
+            QCoreApplication app(argc, argv);
+            app.setOrganizationName("Chizhong Jin");
+            app.setApplicationName("csv-editor");
+            return BatchJob().run(app.arguments());
+        }
+    }
+
     QApplication app(argc, argv);
 
     app.setOrganizationName("Chizhong Jin");
@@ -1,31 +1,82 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "csv.h"
+#include "csvfile.h"
+#include "cellstore.h"
 #include "tablewidget.h"
 #include "dialogaddcolumn.h"
+#include "dialogfind.h"
+#include "dialogstorage.h"
+#include "statisticspanel.h"
+#include "sorter.h"
+#include "rowfilter.h"
 
+#include <QApplication>
 #include <QDebug>
 #include <QMessageBox>
 #include <QCloseEvent>
 #include <QSettings>
 #include <QFileDialog>
+#include <QInputDialog>
+#include <QSaveFile>
 #include <QClipboard>
 #include <QMimeData>
 #include <QDesktopServices>
+#include <QDockWidget>
+#include <QEventLoop>
+#include <QFutureWatcher>
+#include <QProgressBar>
+#include <QProgressDialog>
+#include <QPushButton>
+#include <QTimer>
+#include <QtConcurrent>
+
+// copies and pastes larger than this run off the gui thread
+static const qint64 BACKGROUND_CELLS = 1 << 16;
+static const int BACKGROUND_BYTES = 1 << 20;
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
-    m_dirt(false)
+    m_find(nullptr),
+    m_dirt(false),
+    m_loader(nullptr),
+    m_generation(0),
+    m_cancelled(false),
+    m_partial(false),
+    m_holdLoading(false),
+    m_heldFinish(false),
+    m_closeWhenLoaded(false)
 {
     ui->setupUi(this);
     m_tw = ui->centralWidget;
 
+    m_progress = new QProgressBar(this);
+    m_progress->setRange(0, 1000);
+    m_progress->setVisible(false);
+    m_cancel = new QPushButton("Cancel", this);
+    m_cancel->setVisible(false);
+    ui->statusBar->addPermanentWidget(m_progress);
+    ui->statusBar->addPermanentWidget(m_cancel);
+
+    m_statistics = new QDockWidget("Statistics", this);
+    m_statistics->setObjectName("statisticsDock");
+    m_statistics->setWidget(new StatisticsPanel(m_statistics, m_tw));
+    m_statistics->setVisible(false);
+    addDockWidget(Qt::RightDockWidgetArea, m_statistics);
+    connect(m_statistics, SIGNAL(visibilityChanged(bool)), ui->actionStatistics, SLOT(setChecked(bool)));
+
+    QSettings s;
+    m_tw->setUndoLimits(s.value("undoMemoryLimit", qint64(256) << 20).toLongLong(),
+                        s.value("undoStepLimit", 0).toInt());
+
     connect(m_tw, SIGNAL(changed()), this, SLOT(onChanged()));
+    connect(m_cancel, SIGNAL(clicked()), this, SLOT(onCancelLoading()));
 }
 
 MainWindow::~MainWindow()
 {
+    _stopLoading();
     delete ui;
 }
 
@@ -36,6 +87,13 @@ void MainWindow::closeEvent(QCloseEvent *event)
         int ir = QMessageBox::information(this, QString(), "Do you want to save the changes you made?",
                                  QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel);
         if (ir == QMessageBox::Yes) {
+            if (m_loader) {
+                // the whole file is saved, so only once it has loaded
+                m_closeWhenLoaded = true;
+                ui->statusBar->showMessage("The file is saved and closed when it has loaded");
+                event->ignore();
+                return;
+            }
             on_actionSave_triggered();
             event->accept();
         } else if (ir == QMessageBox::No) {
@@ -64,38 +122,46 @@ QString MainWindow::_getOpenFile()
 
 void MainWindow::openFile(QString fname)
 {
-    QString strCont;
+    _stopLoading();
+
+    // map the file and decode rows on demand, show the first rows right
+    // away and index the rest in the background
+    QSharedPointer<CsvFile> csv(new CsvFile);
+    if (csv->open(fname, false)) {
+        CsvLoader::loadHead(csv.data());
+        m_tw->attach(csv);
+        m_tw->resizeColumnsToContents();
+
+        m_dirt = false;
+        m_partial = false;
+        m_filename = fname;
+        m_dialect = csv->dialect();
+        m_dialect.crlf = csv->crlf();
+        updateTitle();
+
+        if (csv->indexed() < csv->size()) {
+            _startLoading(csv);
+        }
+        return;
+    }
+
     QFile file(fname);
     if (!file.open(QIODevice::ReadOnly)) {
         QMessageBox::critical(this, "Error", "Cannot open " + fname);
         return;
     }
-    QTextStream stm(&file);
-    stm.setCodec("UTF-8");
-    strCont = stm.readAll();
+    QByteArray bytes = file.readAll();
     file.close();
 
-    QList<QStringList> cont = CSV::parseFromString(strCont);
+    m_dialect = CSV::sniff(bytes.constData(), bytes.size());
+    m_tw->load(CSV::parseGrids(bytes, m_dialect));
 
-    m_tw->reset();
     m_dirt = false;
-
-    QStringList header = cont[0];
-    cont.pop_front();
-    int columns = header.length();
-    for (int i = 0; i < columns; ++i) {
-        m_tw->addColumn(header[i]);
-    }
-
-    for (int i = 0; i < cont.length(); ++i) {
-        QStringList line = cont[i];
-        m_tw->addRow(line);
-    }
+    m_partial = false;
 
     m_tw->resizeColumnsToContents();
 
     m_filename = fname;
-    m_crlf = _guessCrlf(strCont);
     updateTitle();
 }
 
@@ -116,53 +182,115 @@ void MainWindow::on_actionOpen_triggered()
 
 void MainWindow::on_actionSave_triggered()
 {
-    QList<QStringList> data;
-
-    QStringList header;
-    for (int i = 0; i < m_tw->columnCount(); ++i) {
-        header.append(m_tw->header(i));
+    if (m_partial) {
+        int ir = QMessageBox::question(this, QString(),
+                "Loading was cancelled, rows that were not loaded will be lost. Save anyway?",
+                QMessageBox::Yes | QMessageBox::No);
+        if (ir != QMessageBox::Yes)
+            return;
+        m_partial = false;
     }
-    data.append(header);
 
-    for (int i = 0; i < m_tw->rowCount(); ++i) {
-        QStringList row;
-        for (int j = 0; j < m_tw->columnCount(); ++j) {
-            row.append(m_tw->text(i, j));
-        }
-        data.append(row);
-    }
+#ifdef Q_OS_WIN
+    // a mapped file cannot be replaced on windows
+    m_tw->materialize();
+#endif
 
-    CSV::write(data, m_filename, "UTF-8", m_crlf);
+    if (!_save(m_filename)) {
+        QMessageBox::critical(this, "Error", "Cannot save " + m_filename);
+        return;
+    }
 
     m_dirt = false;
     updateTitle();
 }
 
+bool MainWindow::_save(const QString &fname)
+{
+    // rows are streamed from the table, which may still be reading the
+    // original file, so write next to it and replace it at the end
+    QSaveFile file(fname);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    CSV::Writer writer(&file, m_dialect);
+    m_tw->write(writer);
+    if (!writer.flush()) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
 void MainWindow::on_actionExit_triggered()
 {
     close();
 }
 
+void MainWindow::_runInBackground(const QString &label, const std::function<void (QAtomicInt &)> &work)
+{
+    // the dialog is modal, so nothing edits the table under the worker;
+    // rows the loader sends in the meantime are only added afterwards
+    m_holdLoading = true;
+
+    QAtomicInt progress(0);
+    QProgressDialog dialog(label, QString(), 0, 1000, this);
+    dialog.setWindowModality(Qt::WindowModal);
+    dialog.setMinimumDuration(0);
+    dialog.setValue(0);
+
+    QTimer timer;
+    connect(&timer, &QTimer::timeout, [&dialog, &progress]() {
+        dialog.setValue(progress.load());
+    });
+    timer.start(50);
+
+    QEventLoop loop;
+    QFutureWatcher<void> watcher;
+    connect(&watcher, SIGNAL(finished()), &loop, SLOT(quit()));
+    watcher.setFuture(QtConcurrent::run([&work, &progress]() {
+        work(progress);
+    }));
+    if (!watcher.isFinished()) {
+        loop.exec();
+    }
+
+    m_holdLoading = false;
+    foreach (const CsvBatch &batch, m_heldBatches) {
+        m_tw->appendSourceRows(batch);
+    }
+    m_heldBatches.clear();
+    if (m_heldFinish) {
+        m_heldFinish = false;
+        _loadingFinished();
+    }
+}
+
 void MainWindow::on_actionCopy_triggered()
 {
     TableWidgetTransaction ts(m_tw, "Copy");
 
+    TableWidgetSelection sel = m_tw->selection();
+    if (sel.row < 0 || sel.col < 0)
+        return;
+
     QClipboard * clip = QGuiApplication::clipboard();
     QMimeData * data = new QMimeData();
-
-    TableWidgetSelection sel = m_tw->selection();
     data->setText(m_tw->text(sel.row, sel.col));
 
-    QList<QStringList> csvData;
-    for (int row = sel.top; row <= sel.bottom; ++row) {
-        QStringList csvRow;
-        for (int col = sel.left; col <= sel.right; ++col) {
-            csvRow << m_tw->text(row, col);
-        }
-        csvData << csvRow;
+    // the csv is the only copy of the cells, the mime data shares it
+    QByteArray csv;
+    qint64 cells = qint64(sel.bottom - sel.top + 1) * (sel.right - sel.left + 1);
+    if (cells < BACKGROUND_CELLS) {
+        csv = m_tw->copyRange(sel);
+    } else {
+        _runInBackground("Copying...", [this, &sel, &csv](QAtomicInt &progress) {
+            csv = m_tw->copyRange(sel, &progress);
+        });
     }
-    QString csv = CSV::toString(csvData);
-    data->setData("text/csv", csv.toUtf8());
+    data->setData("text/csv", csv);
 
     clip->setMimeData(data);
 }
@@ -182,38 +310,130 @@ void MainWindow::on_actionPaste_triggered()
     QClipboard * clip = QGuiApplication::clipboard();
     const QMimeData * mime = clip->mimeData();
 
-    QList<QStringList> grid;
+    CellGrid grid;
     if (mime->hasFormat("text/csv")) {
-        QString csv = QString::fromUtf8(mime->data("text/csv"));
-        grid = CSV::parseFromString(csv);
+        QByteArray csv = mime->data("text/csv");
+        if (csv.size() < BACKGROUND_BYTES) {
+            grid = CSV::parseGrid(csv);
+        } else {
+            _runInBackground("Pasting...", [&csv, &grid](QAtomicInt &progress) {
+                grid = CSV::parseGrid(csv, &progress);
+            });
+        }
     } else {
-        QStringList sl;
-        sl << mime->text();
-        grid << sl;
+        grid.addRow();
+        grid.addCell(mime->text());
     }
 
-    TableWidgetSelection sel = m_tw->selection();
-    for (int row = sel.top; row <= sel.bottom; ++row) {
-        for (int col = sel.left; col <= sel.right; ++col) {
-            QStringList x = grid[(row - sel.top) % grid.length()];
-            QString text = x[(col - sel.left) % x.length()];
-            m_tw->setText(row, col, text);
-        }
-    }
+    m_tw->setRange(m_tw->selection(), grid);
 }
 
 void MainWindow::on_actionClear_triggered()
 {
     TableWidgetTransaction ts(m_tw, "Clear");
 
+    m_tw->clearRange(m_tw->selection());
+}
+
+
+void MainWindow::on_actionFind_triggered()
+{
+    if (!m_find) {
+        m_find = new DialogFind(this, m_tw);
+    }
+    m_find->show();
+    m_find->raise();
+    m_find->activateWindow();
+}
+
+void MainWindow::on_actionInsertRowsAbove_triggered()
+{
     TableWidgetSelection sel = m_tw->selection();
-    for (int row = sel.top; row <= sel.bottom; ++row) {
-        for (int col = sel.left; col <= sel.right; ++col) {
-            m_tw->setText(row, col, "");
-        }
+    if (sel.row < 0)
+        return;
+    m_tw->insertRows(sel.top, sel.bottom - sel.top + 1);
+}
+
+void MainWindow::on_actionInsertRowsBelow_triggered()
+{
+    TableWidgetSelection sel = m_tw->selection();
+    if (sel.row < 0)
+        return;
+    m_tw->insertRows(sel.bottom + 1, sel.bottom - sel.top + 1);
+}
+
+void MainWindow::on_actionDeleteRows_triggered()
+{
+    TableWidgetSelection sel = m_tw->selection();
+    if (sel.row < 0)
+        return;
+    m_tw->removeRows(sel.top, sel.bottom - sel.top + 1);
+}
+
+void MainWindow::on_actionFilter_triggered()
+{
+    bool ok = false;
+    QString text = QInputDialog::getText(this, "Filter", "Show rows where", QLineEdit::Normal,
+                                         m_filterText, &ok);
+    if (!ok || text.trimmed().isEmpty())
+        return;
+    m_filterText = text;
+
+    QStringList headers;
+    for (int c = 0; c < m_tw->columnCount(); ++c) {
+        headers << m_tw->header(c);
+    }
+
+    RowFilter filter;
+    if (!filter.compile(text, headers)) {
+        QMessageBox::warning(this, "Filter", filter.errorString());
+        return;
     }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    m_tw->clearFilter();
+    int total = m_tw->rowCount();
+    int shown = m_tw->applyFilter(filter);
+    QApplication::restoreOverrideCursor();
+
+    ui->statusBar->showMessage(QString("%1 of %2 rows").arg(shown).arg(total));
+}
+
+void MainWindow::on_actionShowAllRows_triggered()
+{
+    m_tw->clearFilter();
+    ui->statusBar->clearMessage();
 }
 
+void MainWindow::on_actionSortAscending_triggered()
+{
+    _sort(Qt::AscendingOrder);
+}
+
+void MainWindow::on_actionSortDescending_triggered()
+{
+    _sort(Qt::DescendingOrder);
+}
+
+void MainWindow::_sort(Qt::SortOrder order)
+{
+    // the selected columns are the keys, from left to right
+    TableWidgetSelection sel = m_tw->selection();
+    if (sel.left < 0)
+        return;
+
+    QVector<SortKey> keys;
+    for (int col = sel.left; col <= sel.right; ++col) {
+        SortKey key;
+        key.column = col;
+        key.order = order;
+        keys.append(key);
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    m_tw->sortRows(keys);
+    QApplication::restoreOverrideCursor();
+}
 
 void MainWindow::on_actionUndo_triggered()
 {
@@ -236,29 +456,126 @@ void MainWindow::onChanged()
     updateTitle();
 }
 
-QString MainWindow::_guessCrlf(const QString & cont)
+void MainWindow::_startLoading(QSharedPointer<CsvFile> file)
+{
+    m_loading = file;
+    m_cancelled = false;
+    m_generation += 1;
+    m_loader = new CsvLoader(this, file, m_generation);
+
+    connect(m_loader, SIGNAL(rowsLoaded(CsvBatch)), this, SLOT(onRowsLoaded(CsvBatch)));
+    connect(m_loader, SIGNAL(progress(qint64,qint64)), this, SLOT(onLoadingProgress(qint64,qint64)));
+    connect(m_loader, SIGNAL(finished()), this, SLOT(onLoadingFinished()));
+
+    m_progress->setValue(0);
+    m_progress->setVisible(true);
+    m_cancel->setVisible(true);
+    _enableWholeFileActions(false);
+    ui->statusBar->showMessage("Save, sort, filter and new columns are available once the file has loaded");
+
+    m_loader->start();
+}
+
+void MainWindow::_stopLoading()
+{
+    if (!m_loader)
+        return;
+
+    m_loader->requestInterruption();
+    m_loader->wait();
+
+    // batches that are still queued belong to the old table
+    m_generation += 1;
+    m_heldBatches.clear();
+    m_heldFinish = false;
+    m_closeWhenLoaded = false;
+    _loadingDone();
+}
+
+void MainWindow::onRowsLoaded(CsvBatch batch)
+{
+    if (batch.generation != m_generation)
+        return;
+
+    if (m_holdLoading) {
+        m_heldBatches.append(batch);
+        return;
+    }
+    m_tw->appendSourceRows(batch);
+}
+
+void MainWindow::onLoadingProgress(qint64 done, qint64 total)
 {
-    int crlf = 0, lf = 0, cr = 0;
+    if (sender() != m_loader || total <= 0)
+        return;
+
+    m_progress->setValue(int(done * 1000 / total));
+}
 
-    QRegularExpression re("(\\r\\n|\\n|\\r)");
-    QRegularExpressionMatchIterator i = re.globalMatch(cont);
+void MainWindow::onLoadingFinished()
+{
+    if (sender() != m_loader)
+        return;
+
+    // after the held batches
+    if (m_holdLoading) {
+        m_heldFinish = true;
+        return;
+    }
+    _loadingFinished();
+}
+
+void MainWindow::_loadingFinished()
+{
+    _loadingDone();
+
+    if (m_closeWhenLoaded) {
+        m_closeWhenLoaded = false;
+        on_actionSave_triggered();
+        if (!m_dirt) {
+            close();
+        }
+    }
+}
+
+void MainWindow::_loadingDone()
+{
+    if (!m_loader)
+        return;
 
-    while (i.hasNext()) {
-        QRegularExpressionMatch match = i.next();
-        QString x = match.captured(1);
-        if (x == "\r\n")
-            crlf += 1;
-        else if (x == "\n")
-            lf += 1;
-        else if (x == "\r")
-            cr += 1;
+    m_partial = m_cancelled && m_loading->indexed() < m_loading->size();
+    m_dialect.crlf = m_loading->crlf();
+    if (!m_partial) {
+        // the next open of this file can skip the scan
+        m_loading->saveIndex();
     }
 
-    if (lf >= crlf && lf >= cr)
-        return "\n";
-    if (crlf >= cr)
-        return "\r\n";
-    return "\r";
+    m_loader->deleteLater();
+    m_loader = nullptr;
+    m_loading.clear();
+
+    m_progress->setVisible(false);
+    m_cancel->setVisible(false);
+    _enableWholeFileActions(true);
+    ui->statusBar->clearMessage();
+}
+
+void MainWindow::_enableWholeFileActions(bool enable)
+{
+    ui->actionSave->setEnabled(enable);
+    ui->actionSortAscending->setEnabled(enable);
+    ui->actionSortDescending->setEnabled(enable);
+    ui->actionFilter->setEnabled(enable);
+    ui->actionAddColumn->setEnabled(enable);
+}
+
+void MainWindow::onCancelLoading()
+{
+    if (!m_loader)
+        return;
+
+    m_cancelled = true;
+    m_loader->requestInterruption();
 }
 
 void MainWindow::on_actionAddColumn_triggered()
@@ -266,3 +583,14 @@ void MainWindow::on_actionAddColumn_triggered()
     DialogAddColumn dlg(this, m_tw);
     dlg.exec();
 }
+
+void MainWindow::on_actionStorage_triggered()
+{
+    DialogStorage dlg(this, m_tw);
+    dlg.exec();
+}
+
+void MainWindow::on_actionStatistics_triggered()
+{
+    m_statistics->setVisible(ui->actionStatistics->isChecked());
+}
@@ -2,12 +2,23 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QSharedPointer>
+
+#include <functional>
+
+#include "csvloader.h"
 
 namespace Ui {
 class MainWindow;
 }
 
 class TableWidget;
+class DialogFind;
+class CsvFile;
+class QAtomicInt;
+class QDockWidget;
+class QProgressBar;
+class QPushButton;
 
 class MainWindow : public QMainWindow
 {
@@ -24,8 +35,18 @@ protected:
 
 private:
     QString _getOpenFile();
-    QString _guessCrlf(const QString & cont);
     void updateTitle();
+    bool _save(const QString &fname);
+
+    void _startLoading(QSharedPointer<CsvFile> file);
+    void _stopLoading();
+    void _loadingFinished();
+    void _loadingDone();
+    // actions that need every row of the file
+    void _enableWholeFileActions(bool enable);
+    void _sort(Qt::SortOrder order);
+    // runs work on a worker thread behind a modal progress dialog
+    void _runInBackground(const QString &label, const std::function<void (QAtomicInt &)> &work);
 
 public slots:
     void on_actionOpen_triggered();
@@ -36,6 +57,19 @@ public slots:
     void on_actionCut_triggered();
     void on_actionPaste_triggered();
     void on_actionClear_triggered();
+    void on_actionFind_triggered();
+
+    void on_actionInsertRowsAbove_triggered();
+    void on_actionInsertRowsBelow_triggered();
+    void on_actionDeleteRows_triggered();
+
+    void on_actionFilter_triggered();
+    void on_actionShowAllRows_triggered();
+
+    void on_actionSortAscending_triggered();
+    void on_actionSortDescending_triggered();
+    void on_actionStorage_triggered();
+    void on_actionStatistics_triggered();
 
     void on_actionUndo_triggered();
     void on_actionRedo_triggered();
@@ -44,16 +78,38 @@ public slots:
 
     void onChanged();
 
+    void onRowsLoaded(CsvBatch batch);
+    void onLoadingProgress(qint64 done, qint64 total);
+    void onLoadingFinished();
+    void onCancelLoading();
+
 private slots:
     void on_actionAddColumn_triggered();
 
 private:
     Ui::MainWindow *ui;
     TableWidget * m_tw;
+    DialogFind * m_find;
+    QString m_filterText;
 
     QString m_filename;
-    QString m_crlf = "\n";
+    CSV::Dialect m_dialect;
     bool m_dirt;
+
+    CsvLoader * m_loader;
+    QSharedPointer<CsvFile> m_loading;
+    int m_generation;
+    bool m_cancelled;
+    bool m_partial;
+    // while a background job reads the table, loaded rows wait here
+    bool m_holdLoading;
+    QVector<CsvBatch> m_heldBatches;
+    bool m_heldFinish;
+    // the window was asked to save and close before loading was done
+    bool m_closeWhenLoaded;
+    QProgressBar * m_progress;
+    QPushButton * m_cancel;
+    QDockWidget * m_statistics;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,395 @@
+#include "rowfilter.h"
+#include "cellstore.h"
+#include "csv.h"
+#include "exprlexer.h"
+
+#include <QtConcurrent>
+
+#include <cstring>
+
+// rows evaluated by one task
+static const int BLOCK_ROWS = 65536;
+
+namespace
+{
+    enum Op {
+        EQ,
+        NE,
+        LT,
+        LE,
+        GT,
+        GE,
+        CONTAINS,
+    };
+
+    // a column, or a literal when column is -1
+    struct Operand
+    {
+        Operand() : column(-1), numeric(false), number(0) {}
+
+        int column;
+        QByteArray text;
+        bool numeric;
+        double number;
+    };
+
+    struct Value
+    {
+        const char * data;
+        int length;
+        bool numeric;
+        double number;
+    };
+
+    Value makeValue(const char * data, int length, bool parse)
+    {
+        Value v;
+        v.data = data;
+        v.length = length;
+        v.number = 0;
+        v.numeric = parse && CSV::toNumber(data, length, v.number);
+        return v;
+    }
+
+    Value makeValue(const Operand &literal)
+    {
+        Value v;
+        v.data = literal.text.constData();
+        v.length = literal.text.size();
+        v.numeric = literal.numeric;
+        v.number = literal.number;
+        return v;
+    }
+
+    bool test(Op op, const Value &a, const Value &b)
+    {
+        if (op == CONTAINS) {
+            if (b.length == 0)
+                return true;
+            if (b.length > a.length)
+                return false;
+            return QByteArray::fromRawData(a.data, a.length).contains(
+                        QByteArray::fromRawData(b.data, b.length));
+        }
+
+        int cmp;
+        if (a.numeric && b.numeric) {
+            cmp = a.number < b.number ? -1 : (a.number > b.number ? 1 : 0);
+        } else if (op != EQ && op != NE && (a.numeric || b.numeric)) {
+            return false;
+        } else {
+            cmp = memcmp(a.data, b.data, qMin(a.length, b.length));
+            if (cmp == 0)
+                cmp = a.length - b.length;
+        }
+
+        switch (op) {
+        case EQ: return cmp == 0;
+        case NE: return cmp != 0;
+        case LT: return cmp < 0;
+        case LE: return cmp <= 0;
+        case GT: return cmp > 0;
+        case GE: return cmp >= 0;
+        default: return false;
+        }
+    }
+}
+
+struct RowFilter::Node
+{
+    enum Type {
+        AND,
+        OR,
+        NOT,
+        COMPARE,
+    };
+
+    Type type;
+    QSharedPointer<Node> left;
+    QSharedPointer<Node> right;
+
+    Op op;
+    Operand a;
+    Operand b;
+};
+
+namespace
+{
+    typedef QSharedPointer<RowFilter::Node> NodePtr;
+
+    class Parser
+    {
+    public:
+        Parser(const QString &expr, const QStringList &headers)
+            : m_lexer(expr, true), m_headers(headers)
+        {
+        }
+
+        NodePtr parse() {
+            _next();
+            NodePtr node = _parseOr();
+            if (node && m_lexer.type() != ExprLexer::END) {
+                _fail("Unexpected " + m_lexer.token());
+            }
+            return m_error.isEmpty() ? node : NodePtr();
+        }
+
+        QString error() const {
+            return m_error;
+        }
+
+    private:
+        NodePtr _parseOr() {
+            NodePtr node = _parseAnd();
+            while (node && _isOp("||")) {
+                _next();
+                node = _combine(RowFilter::Node::OR, node, _parseAnd());
+            }
+            return node;
+        }
+
+        NodePtr _parseAnd() {
+            NodePtr node = _parseUnary();
+            while (node && _isOp("&&")) {
+                _next();
+                node = _combine(RowFilter::Node::AND, node, _parseUnary());
+            }
+            return node;
+        }
+
+        NodePtr _parseUnary() {
+            if (_isOp("!")) {
+                _next();
+                return _combine(RowFilter::Node::NOT, _parseUnary(), NodePtr());
+            }
+            if (_isOp("(")) {
+                _next();
+                NodePtr node = _parseOr();
+                if (node && !_isOp(")")) {
+                    return _fail("Missing )");
+                }
+                _next();
+                return node;
+            }
+            return _parseCompare();
+        }
+
+        NodePtr _parseCompare() {
+            NodePtr node(new RowFilter::Node);
+            node->type = RowFilter::Node::COMPARE;
+
+            if (!_parseOperand(node->a))
+                return NodePtr();
+
+            static const char * const ops[] = { "==", "!=", "<", "<=", ">", ">=", "~" };
+            int op = -1;
+            for (int i = 0; m_lexer.type() == ExprLexer::OP && i < 7; ++i) {
+                if (m_lexer.token() == ops[i])
+                    op = i;
+            }
+            if (op < 0) {
+                return _fail("Expected a comparison after " + m_lexer.last());
+            }
+            node->op = Op(op);
+            _next();
+
+            if (!_parseOperand(node->b))
+                return NodePtr();
+            return node;
+        }
+
+        bool _parseOperand(Operand &operand) {
+            if (m_lexer.type() == ExprLexer::NAME) {
+                operand.column = m_headers.indexOf(m_lexer.token());
+                if (operand.column < 0) {
+                    _fail("Unknown column " + m_lexer.token());
+                    return false;
+                }
+            } else if (m_lexer.type() == ExprLexer::STRING || m_lexer.type() == ExprLexer::NUMBER) {
+                operand.text = m_lexer.token().toUtf8();
+                operand.numeric = CSV::toNumber(operand.text.constData(), operand.text.size(),
+                                           operand.number);
+            } else {
+                _fail(m_lexer.type() == ExprLexer::END ? QString("Unexpected end") : "Unexpected " + m_lexer.token());
+                return false;
+            }
+            _next();
+            return true;
+        }
+
+        NodePtr _combine(RowFilter::Node::Type type, NodePtr left, NodePtr right) {
+            if (!left || (type != RowFilter::Node::NOT && !right))
+                return NodePtr();
+
+            NodePtr node(new RowFilter::Node);
+            node->type = type;
+            node->left = left;
+            node->right = right;
+            return node;
+        }
+
+        bool _isOp(const char * op) const {
+            return m_lexer.isOp(op);
+        }
+
+        NodePtr _fail(const QString &error) {
+            if (m_error.isEmpty())
+                m_error = error;
+            return NodePtr();
+        }
+
+        void _next() {
+            m_lexer.next();
+            if (!m_lexer.errorString().isEmpty()) {
+                _fail(m_lexer.errorString());
+            }
+        }
+
+    private:
+        ExprLexer m_lexer;
+        QStringList m_headers;
+        QString m_error;
+    };
+
+    // mask[i] tells whether row begin + i matches
+    void evaluateNode(const RowFilter::Node * node, const CellStore &store,
+                      int begin, int end, QVector<char> &mask)
+    {
+        int count = end - begin;
+
+        switch (node->type) {
+        case RowFilter::Node::AND:
+        case RowFilter::Node::OR: {
+            evaluateNode(node->left.data(), store, begin, end, mask);
+
+            // no need to look at the other side when it cannot change anything
+            bool isAnd = node->type == RowFilter::Node::AND;
+            if (!mask.contains(isAnd ? 1 : 0))
+                return;
+
+            QVector<char> other;
+            evaluateNode(node->right.data(), store, begin, end, other);
+            for (int i = 0; i < count; ++i) {
+                mask[i] = isAnd ? (mask[i] && other[i]) : (mask[i] || other[i]);
+            }
+            return;
+        }
+
+        case RowFilter::Node::NOT:
+            evaluateNode(node->left.data(), store, begin, end, mask);
+            for (int i = 0; i < count; ++i) {
+                mask[i] = !mask[i];
+            }
+            return;
+
+        case RowFilter::Node::COMPARE:
+            break;
+        }
+
+        const Operand &a = node->a;
+        const Operand &b = node->b;
+        bool parse = node->op != CONTAINS;
+        mask.fill(0, count);
+
+        if (a.column < 0 && b.column < 0) {
+            mask.fill(test(node->op, makeValue(a), makeValue(b)), count);
+            return;
+        }
+
+        if (a.column >= 0 && b.column >= 0) {
+            QVector<int> columns;
+            columns << a.column << b.column;
+
+            QByteArray first;
+            store.visitCells(begin, end, columns,
+                             [&](int r, int i, const char * data, int length) {
+                if (i == 0) {
+                    first = QByteArray(data, length);
+                } else {
+                    Value va = makeValue(first.constData(), first.size(), parse);
+                    mask[r - begin] = test(node->op, va, makeValue(data, length, parse));
+                }
+            });
+            return;
+        }
+
+        // a column against a literal, the common case
+        bool columnFirst = a.column >= 0;
+        Value literal = makeValue(columnFirst ? b : a);
+        QVector<int> columns;
+        columns << (columnFirst ? a.column : b.column);
+
+        // numbers of a typed column are compared as they are
+        CellStore::Type type = store.columnType(columns[0]);
+        if (parse && literal.numeric && (type == CellStore::Integer || type == CellStore::Decimal)) {
+            Value cell = makeValue(nullptr, 0, false);
+            for (int r = begin; r < end; ++r) {
+                cell.numeric = store.number(r, columns[0], cell.number);
+                mask[r - begin] = columnFirst ? test(node->op, cell, literal)
+                                              : test(node->op, literal, cell);
+            }
+            return;
+        }
+
+        store.visitCells(begin, end, columns,
+                         [&](int r, int, const char * data, int length) {
+            Value cell = makeValue(data, length, parse && literal.numeric);
+            mask[r - begin] = columnFirst ? test(node->op, cell, literal)
+                                          : test(node->op, literal, cell);
+        });
+    }
+
+    struct Block
+    {
+        int begin;
+        int end;
+        QVector<int> rows;
+    };
+}
+
+RowFilter::RowFilter()
+{
+}
+
+bool RowFilter::compile(const QString &expr, const QStringList &headers)
+{
+    Parser parser(expr, headers);
+    m_root = parser.parse();
+    m_error = parser.error();
+    return !m_root.isNull();
+}
+
+QString RowFilter::errorString() const
+{
+    return m_error;
+}
+
+QVector<int> RowFilter::evaluate(const CellStore &store) const
+{
+    QVector<int> rows;
+    if (!m_root)
+        return rows;
+
+    QVector<Block> blocks;
+    for (int r = 0; r < store.rowCount(); r += BLOCK_ROWS) {
+        Block block;
+        block.begin = r;
+        block.end = qMin(r + BLOCK_ROWS, store.rowCount());
+        blocks.append(block);
+    }
+
+    const Node * root = m_root.data();
+    QtConcurrent::blockingMap(blocks, [root, &store](Block &block) {
+        QVector<char> mask;
+        evaluateNode(root, store, block.begin, block.end, mask);
+        for (int i = 0; i < mask.size(); ++i) {
+            if (mask[i])
+                block.rows.append(block.begin + i);
+        }
+    });
+
+    foreach (const Block &block, blocks) {
+        rows += block.rows;
+    }
+    return rows;
+}
@@ -0,0 +1,40 @@
+#ifndef ROWFILTER_H
+#define ROWFILTER_H
+
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+
+class CellStore;
+
+// Selects rows with a predicate over columns, such as
+//
+//   status == "FAILED" && latency > 500
+//
+// Columns are named by their header, in backquotes when the name is not a
+// plain identifier. Comparisons are ==, !=, <, <=, >, >= and ~ (contains),
+// combined with &&, || and ! and parentheses. A comparison is numeric when
+// both sides are numbers, else it compares text; <, <=, > and >= against a
+// number never match text.
+//
+// The predicate is evaluated one comparison at a time over a whole block
+// of rows, blocks run on all cores.
+class RowFilter
+{
+public:
+    RowFilter();
+
+    bool compile(const QString &expr, const QStringList &headers);
+    QString errorString() const;
+
+    // matching rows, in order
+    QVector<int> evaluate(const CellStore &store) const;
+
+    struct Node;
+
+private:
+    QSharedPointer<Node> m_root;
+    QString m_error;
+};
+
+#endif // ROWFILTER_H
@@ -0,0 +1,289 @@
+#include "sorter.h"
+#include "cellstore.h"
+#include "csv.h"
+
+#include <QDateTime>
+#include <QThread>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// rows read by one task
+static const int BLOCK_ROWS = 16384;
+
+namespace
+{
+    enum KeyType {
+        NUMBER,
+        DATE,
+        TEXT,
+    };
+
+    struct Block
+    {
+        int begin;
+        int end;
+        // per key: no value failed to parse as a number or a date
+        QVector<bool> numbers;
+        QVector<bool> dates;
+    };
+
+    struct Run
+    {
+        int begin;
+        int end;
+    };
+
+    struct Merge
+    {
+        Run left;
+        Run right;
+    };
+
+    struct Keys
+    {
+        KeyType type;
+        bool descending;
+        // NaN for empty values
+        QVector<double> numbers;
+        QVector<QByteArray> texts;
+    };
+
+    bool parseDate(const char * data, int length, double &value)
+    {
+        // iso dates only, yyyy-MM-dd with an optional time. Times without
+        // an offset are UTC like in a Timestamp column, so no time zone or
+        // daylight saving change can reorder them
+        if (length < 10 || data[4] != '-' || data[7] != '-')
+            return false;
+
+        QString text = QString::fromLatin1(data, length);
+        QDate date = QDate::fromString(text.left(10), Qt::ISODate);
+        QDateTime dt;
+        if (length == 10) {
+            dt = QDateTime(date, QTime(0, 0), Qt::UTC);
+        } else if (length == 19 && (data[10] == 'T' || data[10] == ' ')) {
+            QTime time = QTime::fromString(text.mid(11), "HH:mm:ss");
+            if (time.isValid())
+                dt = QDateTime(date, time, Qt::UTC);
+        } else {
+            // fractions of a second or an offset
+            dt = QDateTime::fromString(text, Qt::ISODate);
+            if (dt.isValid() && dt.timeSpec() == Qt::LocalTime)
+                dt = QDateTime(dt.date(), dt.time(), Qt::UTC);
+        }
+        if (!dt.isValid())
+            return false;
+
+        value = double(dt.toMSecsSinceEpoch());
+        return true;
+    }
+
+    class Less
+    {
+    public:
+        explicit Less(const QVector<Keys> &keys)
+            : m_keys(keys)
+        {
+        }
+
+        bool operator()(int a, int b) const {
+            for (int k = 0; k < m_keys.size(); ++k) {
+                int cmp = compare(m_keys[k], a, b);
+                if (cmp != 0)
+                    return cmp < 0;
+            }
+            return false;
+        }
+
+    private:
+        static int compare(const Keys &keys, int a, int b) {
+            bool emptyA, emptyB;
+            int cmp = 0;
+
+            if (keys.type == TEXT) {
+                const QByteArray &ta = keys.texts[a];
+                const QByteArray &tb = keys.texts[b];
+                emptyA = ta.isEmpty();
+                emptyB = tb.isEmpty();
+                if (!emptyA && !emptyB) {
+                    // utf-8 bytes compare in code point order
+                    int n = qMin(ta.size(), tb.size());
+                    cmp = memcmp(ta.constData(), tb.constData(), n);
+                    if (cmp == 0)
+                        cmp = ta.size() - tb.size();
+                }
+            } else {
+                double na = keys.numbers[a];
+                double nb = keys.numbers[b];
+                emptyA = std::isnan(na);
+                emptyB = std::isnan(nb);
+                if (!emptyA && !emptyB)
+                    cmp = na < nb ? -1 : (na > nb ? 1 : 0);
+            }
+
+            // empty values go last, whatever the order
+            if (emptyA || emptyB)
+                return int(emptyA) - int(emptyB);
+
+            return keys.descending ? -cmp : cmp;
+        }
+
+        const QVector<Keys> &m_keys;
+    };
+}
+
+Sorter::Sorter(const QVector<SortKey> &keys)
+    : m_keys(keys)
+{
+}
+
+QVector<int> Sorter::sort(const CellStore &store) const
+{
+    int rows = store.rowCount();
+    QVector<int> columns;
+    // keys on typed columns, which hold their values already
+    QVector<bool> typed;
+    foreach (const SortKey &key, m_keys) {
+        columns.append(key.column);
+        CellStore::Type type = store.columnType(key.column);
+        typed.append(type != CellStore::Text && type != CellStore::Dictionary);
+    }
+
+    QVector<Block> blocks;
+    for (int r = 0; r < rows; r += BLOCK_ROWS) {
+        Block block;
+        block.begin = r;
+        block.end = qMin(r + BLOCK_ROWS, rows);
+        block.numbers.fill(true, columns.size());
+        block.dates.fill(true, columns.size());
+        blocks.append(block);
+    }
+
+    // first pass, find out what every text column holds
+    QtConcurrent::blockingMap(blocks, [&store, &columns, &typed](Block &block) {
+        store.visitCells(block.begin, block.end, columns,
+                         [&block, &typed](int, int i, const char * data, int length) {
+            double value;
+            if (length == 0 || typed[i])
+                return;
+            if (block.numbers[i] && !CSV::toNumber(data, length, value))
+                block.numbers[i] = false;
+            if (block.dates[i] && !parseDate(data, length, value))
+                block.dates[i] = false;
+        });
+    });
+
+    QVector<Keys> keys(m_keys.size());
+    for (int k = 0; k < keys.size(); ++k) {
+        bool numbers = true;
+        bool dates = true;
+        foreach (const Block &block, blocks) {
+            numbers = numbers && block.numbers[k];
+            dates = dates && block.dates[k];
+        }
+
+        if (typed[k])
+            keys[k].type = NUMBER;
+        else
+            keys[k].type = numbers ? NUMBER : (dates ? DATE : TEXT);
+        keys[k].descending = m_keys[k].order == Qt::DescendingOrder;
+        if (keys[k].type == TEXT)
+            keys[k].texts.resize(rows);
+        else
+            keys[k].numbers.resize(rows);
+    }
+
+    QVector<int> textColumns;
+    QVector<int> textKeys;
+    for (int k = 0; k < keys.size(); ++k) {
+        if (!typed[k]) {
+            textColumns.append(columns[k]);
+            textKeys.append(k);
+        }
+    }
+
+    // second pass, read the keys, typed columns without any parsing
+    QtConcurrent::blockingMap(blocks, [&](Block &block) {
+        for (int k = 0; k < keys.size(); ++k) {
+            if (!typed[k])
+                continue;
+            for (int r = block.begin; r < block.end; ++r) {
+                double value;
+                if (!store.number(r, columns[k], value))
+                    value = std::nan("");
+                keys[k].numbers[r] = value;
+            }
+        }
+        if (textColumns.isEmpty())
+            return;
+
+        store.visitCells(block.begin, block.end, textColumns,
+                         [&keys, &textKeys](int r, int i, const char * data, int length) {
+            Keys &key = keys[textKeys[i]];
+            double value = std::nan("");
+            if (key.type == TEXT) {
+                key.texts[r] = QByteArray(data, length);
+            } else if (length > 0) {
+                if (key.type == NUMBER)
+                    CSV::toNumber(data, length, value);
+                else
+                    parseDate(data, length, value);
+                key.numbers[r] = value;
+            } else {
+                key.numbers[r] = value;
+            }
+        });
+    });
+
+    // every run is sorted on its own, then runs are merged in pairs until
+    // one is left
+    QVector<int> order(rows);
+    QVector<int> buffer(rows);
+    for (int r = 0; r < rows; ++r) {
+        order[r] = r;
+    }
+
+    int * src = order.data();
+    int * dst = buffer.data();
+    Less less(keys);
+
+    int threads = qMax(1, QThread::idealThreadCount());
+    int runLength = qMax(BLOCK_ROWS, (rows + threads - 1) / threads);
+    QVector<Run> runs;
+    for (int r = 0; r < rows; r += runLength) {
+        Run run;
+        run.begin = r;
+        run.end = qMin(r + runLength, rows);
+        runs.append(run);
+    }
+
+    QtConcurrent::blockingMap(runs, [src, &less](Run &run) {
+        std::stable_sort(src + run.begin, src + run.end, less);
+    });
+
+    while (runs.size() > 1) {
+        QVector<Merge> merges;
+        QVector<Run> merged;
+        for (int i = 0; i < runs.size(); i += 2) {
+            Merge merge;
+            merge.left = runs[i];
+            merge.right = i + 1 < runs.size() ? runs[i + 1] : Run{runs[i].end, runs[i].end};
+            merges.append(merge);
+            merged.append(Run{merge.left.begin, merge.right.end});
+        }
+
+        QtConcurrent::blockingMap(merges, [src, dst, &less](Merge &merge) {
+            std::merge(src + merge.left.begin, src + merge.left.end,
+                       src + merge.right.begin, src + merge.right.end,
+                       dst + merge.left.begin, less);
+        });
+
+        std::swap(src, dst);
+        runs = merged;
+    }
+
+    return src == order.data() ? order : buffer;
+}
@@ -0,0 +1,31 @@
+#ifndef SORTER_H
+#define SORTER_H
+
+#include <QVector>
+
+class CellStore;
+
+struct SortKey
+{
+    int column;
+    Qt::SortOrder order;
+};
+
+// Sorts rows by one or more columns without moving any cell, the result
+// is a permutation of the rows. A column compares as numbers, dates or
+// text, whichever all of its non-empty values parse as, and empty values
+// always go last. Keys are read and rows sorted on all cores, the sort is
+// stable.
+class Sorter
+{
+public:
+    explicit Sorter(const QVector<SortKey> &keys);
+
+    // the row to show at every position
+    QVector<int> sort(const CellStore &store) const;
+
+private:
+    QVector<SortKey> m_keys;
+};
+
+#endif // SORTER_H
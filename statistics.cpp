@@ -0,0 +1,338 @@
+#include "statistics.h"
+#include "cellstore.h"
+#include "csv.h"
+
+#include <QtConcurrent>
+
+#include <limits>
+
+// rows scanned by one task
+static const int BLOCK_ROWS = 65536;
+
+// distinct values are counted up to this many, a column of ids would
+// otherwise keep a copy of itself
+static const int DISTINCT_LIMIT = 1 << 20;
+
+struct Statistics::Run
+{
+    int begin;
+    int end;
+};
+
+struct Statistics::Tally
+{
+    Tally()
+        : cells(0), empty(0), numbers(0), sum(0)
+        , min(std::numeric_limits<double>::infinity())
+        , max(-std::numeric_limits<double>::infinity())
+        , bounded(true), counted(true)
+    {
+    }
+
+    void add(const char * data, int length)
+    {
+        double value = 0;
+        add(data, length, length > 0 && CSV::toNumber(data, length, value), value);
+    }
+
+    // a cell whose number, if it holds one, is known already
+    void add(const char * data, int length, bool number, double value)
+    {
+        cells += 1;
+        if (length == 0) {
+            empty += 1;
+            return;
+        }
+
+        if (number) {
+            numbers += 1;
+            sum += value;
+            min = qMin(min, value);
+            max = qMax(max, value);
+        }
+
+        if (counted) {
+            values[QByteArray(data, length)] += 1;
+            if (values.size() > DISTINCT_LIMIT) {
+                counted = false;
+                values.clear();
+            }
+        }
+    }
+
+    void merge(const Tally &other)
+    {
+        cells += other.cells;
+        empty += other.empty;
+        numbers += other.numbers;
+        sum += other.sum;
+        min = qMin(min, other.min);
+        max = qMax(max, other.max);
+        bounded = bounded && other.bounded;
+
+        counted = counted && other.counted;
+        if (counted) {
+            for (QHash<QByteArray, qint64>::const_iterator it = other.values.begin(); it != other.values.end(); ++it) {
+                values[it.key()] += it.value();
+            }
+            if (values.size() > DISTINCT_LIMIT)
+                counted = false;
+        }
+        if (!counted)
+            values.clear();
+    }
+
+    void subtract(const Tally &other)
+    {
+        cells -= other.cells;
+        empty -= other.empty;
+        numbers -= other.numbers;
+        sum -= other.sum;
+
+        // the extremes may be gone, there is no telling without a scan
+        if (other.numbers > 0 && (other.min <= min || other.max >= max))
+            bounded = false;
+        if (numbers == 0) {
+            sum = 0;
+            min = std::numeric_limits<double>::infinity();
+            max = -std::numeric_limits<double>::infinity();
+            bounded = true;
+        }
+
+        counted = counted && other.counted;
+        if (counted) {
+            for (QHash<QByteArray, qint64>::const_iterator it = other.values.begin(); it != other.values.end(); ++it) {
+                QHash<QByteArray, qint64>::iterator own = values.find(it.key());
+                if (own != values.end() && (*own -= it.value()) <= 0)
+                    values.erase(own);
+            }
+        } else {
+            values.clear();
+        }
+    }
+
+    Summary summary() const
+    {
+        Summary s;
+        s.cells = cells;
+        s.empty = empty;
+        s.distinct = counted ? values.size() : -1;
+        s.numbers = numbers;
+        if (numbers > 0) {
+            s.sum = sum;
+            s.min = min;
+            s.max = max;
+        }
+        return s;
+    }
+
+    qint64 cells;
+    qint64 empty;
+    qint64 numbers;
+    double sum;
+    double min;
+    double max;
+    // false once a removed number may have been the smallest or largest
+    bool bounded;
+    // how often every value occurs, until there are too many
+    QHash<QByteArray, qint64> values;
+    bool counted;
+};
+
+namespace
+{
+    struct Block
+    {
+        QVector<Statistics::Run> runs;
+        QVector<Statistics::Tally> tallies;
+    };
+
+    QVector<Statistics::Run> runsOf(const QVector<int> &rows)
+    {
+        QVector<Statistics::Run> runs;
+        foreach (int r, rows) {
+            if (!runs.isEmpty() && runs.last().end == r) {
+                runs.last().end += 1;
+            } else {
+                Statistics::Run run;
+                run.begin = r;
+                run.end = r + 1;
+                runs.append(run);
+            }
+        }
+        return runs;
+    }
+
+    QVector<Statistics::Run> runOf(int top, int bottom)
+    {
+        QVector<Statistics::Run> runs;
+        if (bottom >= top) {
+            Statistics::Run run;
+            run.begin = top;
+            run.end = bottom + 1;
+            runs.append(run);
+        }
+        return runs;
+    }
+}
+
+Statistics::Summary::Summary()
+    : cells(0), empty(0), distinct(0), numbers(0), sum(0), min(0), max(0)
+{
+}
+
+double Statistics::Summary::mean() const
+{
+    return numbers > 0 ? sum / numbers : 0;
+}
+
+Statistics::Statistics(const CellStore &store)
+    : m_store(store)
+{
+}
+
+Statistics::Summary Statistics::column(int c)
+{
+    QSharedPointer<Tally> tally = m_columns.value(c);
+    if (!tally || !tally->bounded) {
+        QVector<int> columns;
+        columns << c;
+        tally.reset(new Tally(_scan(runOf(0, m_store.rowCount() - 1), columns)[0]));
+        m_columns.insert(c, tally);
+    }
+    return tally->summary();
+}
+
+Statistics::Summary Statistics::rows(const QVector<int> &rows, int left, int right) const
+{
+    QVector<int> columns;
+    for (int c = left; c <= right; ++c) {
+        columns.append(c);
+    }
+
+    Tally total;
+    foreach (const Tally &tally, _scan(runsOf(rows), columns)) {
+        total.merge(tally);
+    }
+    return total.summary();
+}
+
+void Statistics::cellsRemoving(int top, int bottom, int left, int right)
+{
+    _update(runOf(top, bottom), left, right, false);
+}
+
+void Statistics::cellsAdded(int top, int bottom, int left, int right)
+{
+    _update(runOf(top, bottom), left, right, true);
+}
+
+void Statistics::cellsRemoving(const QVector<int> &rows, int left, int right)
+{
+    _update(runsOf(rows), left, right, false);
+}
+
+void Statistics::cellsAdded(const QVector<int> &rows, int left, int right)
+{
+    _update(runsOf(rows), left, right, true);
+}
+
+void Statistics::columnRemoved(int c)
+{
+    m_columns.remove(c);
+}
+
+void Statistics::clear()
+{
+    m_columns.clear();
+}
+
+void Statistics::_update(const QVector<Run> &runs, int left, int right, bool added)
+{
+    QVector<int> columns;
+    for (QHash<int, QSharedPointer<Tally> >::const_iterator it = m_columns.begin(); it != m_columns.end(); ++it) {
+        // a column that scans again anyway need not be kept current
+        if (it.key() >= left && it.key() <= right && it.value()->bounded)
+            columns.append(it.key());
+    }
+    if (columns.isEmpty() || runs.isEmpty())
+        return;
+
+    QVector<Tally> changed = _scan(runs, columns);
+    for (int i = 0; i < columns.size(); ++i) {
+        Tally &tally = *m_columns[columns[i]];
+        if (added)
+            tally.merge(changed[i]);
+        else
+            tally.subtract(changed[i]);
+    }
+}
+
+QVector<Statistics::Tally> Statistics::_scan(const QVector<Run> &runs, const QVector<int> &columns) const
+{
+    // runs are cut into blocks of about the same number of rows
+    QVector<Block> blocks(1);
+    int rows = 0;
+    foreach (const Run &run, runs) {
+        for (int r = run.begin; r < run.end; ) {
+            if (rows == BLOCK_ROWS) {
+                blocks.append(Block());
+                rows = 0;
+            }
+            Run piece;
+            piece.begin = r;
+            piece.end = qMin(run.end, r + BLOCK_ROWS - rows);
+            blocks.last().runs.append(piece);
+            rows += piece.end - piece.begin;
+            r = piece.end;
+        }
+    }
+
+    // integer and decimal columns hold their numbers already, timestamps
+    // are no numbers to sum up
+    QVector<CellStore::Type> types;
+    foreach (int c, columns) {
+        types.append(m_store.columnType(c));
+    }
+
+    const CellStore &store = m_store;
+    auto scan = [&store, &columns, &types](Block &block) {
+        block.tallies.resize(columns.size());
+        foreach (const Run &run, block.runs) {
+            store.visitCells(run.begin, run.end, columns,
+                             [&](int r, int i, const char * data, int length) {
+                double value;
+                switch (types[i]) {
+                case CellStore::Integer:
+                case CellStore::Decimal:
+                    if (store.number(r, columns[i], value))
+                        block.tallies[i].add(data, length, true, value);
+                    else
+                        block.tallies[i].add(data, length);
+                    break;
+                case CellStore::Timestamp:
+                    block.tallies[i].add(data, length, false, 0);
+                    break;
+                default:
+                    block.tallies[i].add(data, length);
+                    break;
+                }
+            });
+        }
+    };
+
+    // a single edited cell is not worth starting tasks for
+    if (blocks.size() == 1) {
+        scan(blocks[0]);
+    } else {
+        QtConcurrent::blockingMap(blocks, scan);
+    }
+
+    QVector<Tally> tallies(columns.size());
+    foreach (const Block &block, blocks) {
+        for (int i = 0; i < block.tallies.size(); ++i) {
+            tallies[i].merge(block.tallies[i]);
+        }
+    }
+    return tallies;
+}
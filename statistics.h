@@ -0,0 +1,64 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <QHash>
+#include <QSharedPointer>
+#include <QVector>
+
+class CellStore;
+
+// Count, distinct values, min/max, sum/mean and empty cells of whole
+// columns or of some rows. Cells are scanned in blocks on all cores.
+//
+// A column is scanned the first time it is asked for. After that the
+// model reports every cell it changes, before and after the change, and
+// only those cells are looked at. Just removing the smallest or largest
+// number of a column makes it scan again.
+class Statistics
+{
+public:
+    struct Summary
+    {
+        Summary();
+
+        qint64 cells;
+        qint64 empty;
+        // -1 when there are too many distinct values to count
+        qint64 distinct;
+        // cells holding a number, sum, min and max are over those
+        qint64 numbers;
+        double sum;
+        double min;
+        double max;
+
+        double mean() const;
+    };
+
+    explicit Statistics(const CellStore &store);
+
+    Summary column(int c);
+    // cells of the given rows of the store in columns [left, right]
+    Summary rows(const QVector<int> &rows, int left, int right) const;
+
+    // rows of the store, called around every change of cells
+    void cellsRemoving(int top, int bottom, int left, int right);
+    void cellsAdded(int top, int bottom, int left, int right);
+    void cellsRemoving(const QVector<int> &rows, int left, int right);
+    void cellsAdded(const QVector<int> &rows, int left, int right);
+    void columnRemoved(int c);
+    void clear();
+
+    struct Run;
+    struct Tally;
+
+private:
+    void _update(const QVector<Run> &runs, int left, int right, bool added);
+    QVector<Tally> _scan(const QVector<Run> &runs, const QVector<int> &columns) const;
+
+private:
+    const CellStore &m_store;
+    // columns asked for so far
+    QHash<int, QSharedPointer<Tally> > m_columns;
+};
+
+#endif // STATISTICS_H
@@ -0,0 +1,75 @@
+#include "statisticspanel.h"
+#include "ui_statisticspanel.h"
+
+#include <QLocale>
+
+StatisticsPanel::StatisticsPanel(QWidget *parent, TableWidget * tw) :
+    QWidget(parent),
+    ui(new Ui::StatisticsPanel),
+    m_tw(tw)
+{
+    ui->setupUi(this);
+
+    connect(m_tw, SIGNAL(changed()), this, SLOT(refresh()));
+    connect(m_tw, SIGNAL(selectionChanged()), this, SLOT(refresh()));
+}
+
+StatisticsPanel::~StatisticsPanel()
+{
+    delete ui;
+}
+
+void StatisticsPanel::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+    refresh();
+}
+
+void StatisticsPanel::refresh()
+{
+    // nothing is scanned while the panel is hidden
+    if (!isVisible())
+        return;
+
+    QList<QLabel *> values;
+    values << ui->labelCount << ui->labelEmpty << ui->labelDistinct << ui->labelNumbers
+           << ui->labelSum << ui->labelMean << ui->labelMin << ui->labelMax;
+
+    TableWidgetSelection sel = m_tw->selection();
+    if (sel.row < 0 || sel.col < 0 || sel.left < 0 || sel.top < 0) {
+        ui->labelScope->setText("Nothing selected");
+        foreach (QLabel * label, values) {
+            label->clear();
+        }
+        return;
+    }
+
+    bool column;
+    Statistics::Summary s = m_tw->statistics(sel, column);
+    QLocale locale;
+
+    if (column) {
+        ui->labelScope->setText(QString("Column %1").arg(m_tw->header(sel.left)));
+    } else {
+        ui->labelScope->setText(QString("%1 rows by %2 columns selected")
+                                .arg(locale.toString(sel.bottom - sel.top + 1))
+                                .arg(locale.toString(sel.right - sel.left + 1)));
+    }
+
+    ui->labelCount->setText(locale.toString(s.cells));
+    ui->labelEmpty->setText(locale.toString(s.empty));
+    ui->labelDistinct->setText(s.distinct < 0 ? "too many to count" : locale.toString(s.distinct));
+    ui->labelNumbers->setText(locale.toString(s.numbers));
+
+    if (s.numbers > 0) {
+        ui->labelSum->setText(locale.toString(s.sum, 'g', 15));
+        ui->labelMean->setText(locale.toString(s.mean(), 'g', 15));
+        ui->labelMin->setText(locale.toString(s.min, 'g', 15));
+        ui->labelMax->setText(locale.toString(s.max, 'g', 15));
+    } else {
+        ui->labelSum->clear();
+        ui->labelMean->clear();
+        ui->labelMin->clear();
+        ui->labelMax->clear();
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef STATISTICSPANEL_H
+#define STATISTICSPANEL_H
+
+#include <QWidget>
+#include "tablewidget.h"
+
+namespace Ui {
+class StatisticsPanel;
+}
+
+// Count, distinct values, min/max, sum/mean and empty cells of the column
+// under the cursor or of the cells selected, kept current while editing
+class StatisticsPanel : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit StatisticsPanel(QWidget *parent, TableWidget * tw);
+    ~StatisticsPanel();
+
+public slots:
+    void refresh();
+
+protected:
+    void showEvent(QShowEvent *event);
+
+private:
+    Ui::StatisticsPanel *ui;
+    TableWidget * m_tw;
+};
+
+#endif // STATISTICSPANEL_H
@@ -0,0 +1,306 @@
+#include "tablemodel.h"
+#include "commandcenter.h"
+#include "csvloader.h"
+
+#include <QSet>
+
+#include <algorithm>
+
+TableModel::TableModel(QObject * parent)
+    : QAbstractTableModel(parent)
+    , m_cc(nullptr)
+    , m_stats(m_store)
+    , m_filtered(false)
+{
+}
+
+void TableModel::setFilter(const QVector<int> &rows)
+{
+    beginResetModel();
+    m_filter = rows;
+    m_filtered = true;
+    endResetModel();
+}
+
+void TableModel::clearFilter()
+{
+    if (!m_filtered)
+        return;
+
+    beginResetModel();
+    m_filter.clear();
+    m_filtered = false;
+    endResetModel();
+}
+
+int TableModel::storeRow(int row) const
+{
+    return m_filtered ? m_filter.at(row) : row;
+}
+
+int TableModel::viewRow(int storeRow) const
+{
+    if (!m_filtered)
+        return storeRow;
+
+    QVector<int>::const_iterator it = std::lower_bound(m_filter.begin(), m_filter.end(), storeRow);
+    return it != m_filter.end() && *it == storeRow ? int(it - m_filter.begin()) : -1;
+}
+
+int TableModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return m_filtered ? m_filter.size() : m_store.rowCount();
+}
+
+int TableModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_store.columnCount();
+}
+
+QVariant TableModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid())
+        return QVariant();
+
+    if (role == Qt::DisplayRole || role == Qt::EditRole)
+        return m_store.text(storeRow(index.row()), index.column());
+
+    return QVariant();
+}
+
+QVariant TableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    if (orientation == Qt::Horizontal)
+        return m_store.header(section);
+
+    // filtered rows keep their numbers
+    return storeRow(section) + 1;
+}
+
+Qt::ItemFlags TableModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return Qt::NoItemFlags;
+
+    return Qt::ItemIsSelectable | Qt::ItemIsEditable | Qt::ItemIsEnabled;
+}
+
+bool TableModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    if (!index.isValid() || role != Qt::EditRole)
+        return false;
+
+    int r = storeRow(index.row());
+    QString oldText = m_store.text(r, index.column());
+    QString newText = value.toString();
+    m_cc->addEdit(r, index.column(), oldText, newText);
+    return true;
+}
+
+void TableModel::setCellText(int r, int c, const QString &text)
+{
+    writeCellText(r, c, text);
+    _storeRowsChanged(r, c, r, c);
+}
+
+void TableModel::writeCellText(int r, int c, const QString &text)
+{
+    m_stats.cellsRemoving(r, r, c, c);
+    m_store.setText(r, c, text);
+    m_stats.cellsAdded(r, r, c, c);
+}
+
+void TableModel::cellsChanged(int top, int left, int bottom, int right)
+{
+    _storeRowsChanged(top, left, bottom, right);
+}
+
+void TableModel::setRange(int top, int left, int bottom, int right, const CellGrid &grid)
+{
+    if (bottom < top || right < left)
+        return;
+
+    m_stats.cellsRemoving(top, bottom, left, right);
+    m_store.writeRange(top, left, bottom, right, grid);
+    m_stats.cellsAdded(top, bottom, left, right);
+    _storeRowsChanged(top, left, bottom, right);
+}
+
+void TableModel::setRows(const QVector<int> &rows, int left, int right, const CellGrid &grid)
+{
+    if (rows.isEmpty() || right < left)
+        return;
+
+    // rows are in order
+    m_stats.cellsRemoving(rows, left, right);
+    m_store.writeRows(rows, left, right, grid);
+    m_stats.cellsAdded(rows, left, right);
+    _storeRowsChanged(rows.first(), left, rows.last(), right);
+}
+
+void TableModel::appendColumn(const QString &title)
+{
+    int col = m_store.columnCount();
+    beginInsertColumns(QModelIndex(), col, col);
+    m_store.addColumn(title);
+    endInsertColumns();
+}
+
+void TableModel::removeLastColumn()
+{
+    int col = m_store.columnCount() - 1;
+    beginRemoveColumns(QModelIndex(), col, col);
+    m_store.removeLastColumn();
+    m_stats.columnRemoved(col);
+    endRemoveColumns();
+}
+
+void TableModel::insertRowIds(int at, const QVector<int> &rows)
+{
+    if (rows.isEmpty())
+        return;
+
+    // new rows are shown with a filter as well, the rows after them move
+    // down
+    int first = m_filtered ? int(std::lower_bound(m_filter.begin(), m_filter.end(), at) - m_filter.begin()) : at;
+    beginInsertRows(QModelIndex(), first, first + rows.size() - 1);
+    m_store.insertRows(at, rows);
+    m_stats.cellsAdded(at, at + rows.size() - 1, 0, m_store.columnCount() - 1);
+    if (m_filtered) {
+        for (int i = first; i < m_filter.size(); ++i) {
+            m_filter[i] += rows.size();
+        }
+        m_filter.insert(first, rows.size(), 0);
+        for (int i = 0; i < rows.size(); ++i) {
+            m_filter[first + i] = at + i;
+        }
+    }
+    endInsertRows();
+}
+
+QVector<int> TableModel::removeRowIds(int at, int count)
+{
+    if (count <= 0)
+        return QVector<int>();
+
+    m_stats.cellsRemoving(at, at + count - 1, 0, m_store.columnCount() - 1);
+
+    // the rows shown in between go, the rows after them move up
+    int first = at;
+    int last = at + count;
+    if (m_filtered) {
+        first = int(std::lower_bound(m_filter.begin(), m_filter.end(), at) - m_filter.begin());
+        last = int(std::lower_bound(m_filter.begin(), m_filter.end(), at + count) - m_filter.begin());
+    }
+
+    if (last > first)
+        beginRemoveRows(QModelIndex(), first, last - 1);
+    QVector<int> rows = m_store.removeRows(at, count);
+    if (m_filtered) {
+        m_filter.remove(first, last - first);
+        for (int i = first; i < m_filter.size(); ++i) {
+            m_filter[i] -= count;
+        }
+    }
+    if (last > first)
+        endRemoveRows();
+    return rows;
+}
+
+void TableModel::setRowOrder(const QVector<int> &order)
+{
+    emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+
+    if (m_filtered) {
+        // the same rows stay shown, in their new order
+        QVector<int> ids = m_store.rowOrder();
+        QSet<int> shown;
+        shown.reserve(m_filter.size());
+        foreach (int r, m_filter) {
+            shown.insert(ids.at(r));
+        }
+
+        m_store.setRowOrder(order);
+        m_filter.resize(0);
+        for (int r = 0; r < order.size(); ++r) {
+            if (shown.contains(order.at(r)))
+                m_filter.append(r);
+        }
+    } else {
+        m_store.setRowOrder(order);
+    }
+
+    emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+}
+
+void TableModel::reset()
+{
+    beginResetModel();
+    m_filter.clear();
+    m_filtered = false;
+    m_store.clear();
+    m_stats.clear();
+    endResetModel();
+}
+
+void TableModel::load(const QVector<CellGrid> &grids)
+{
+    beginResetModel();
+    m_filter.clear();
+    m_filtered = false;
+    m_store.load(grids);
+    m_stats.clear();
+    endResetModel();
+}
+
+void TableModel::attach(QSharedPointer<CsvFile> file)
+{
+    beginResetModel();
+    m_filter.clear();
+    m_filtered = false;
+    m_store.attach(file);
+    m_stats.clear();
+    endResetModel();
+}
+
+void TableModel::appendSourceRows(const CsvBatch &batch)
+{
+    if (batch.ends.isEmpty())
+        return;
+
+    int first = m_store.rowCount();
+    int last = first + batch.ends.size() - 1;
+
+    // the filter was evaluated before these rows came in, they stay hidden
+    if (m_filtered) {
+        m_store.appendSourceRows(batch.ends, batch.endings);
+        m_stats.cellsAdded(first, last, 0, m_store.columnCount() - 1);
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), first, last);
+    m_store.appendSourceRows(batch.ends, batch.endings);
+    m_stats.cellsAdded(first, last, 0, m_store.columnCount() - 1);
+    endInsertRows();
+}
+
+void TableModel::_storeRowsChanged(int top, int left, int bottom, int right)
+{
+    if (bottom < top || right < left)
+        return;
+
+    if (m_filtered) {
+        // the rows of the view in between
+        top = int(std::lower_bound(m_filter.begin(), m_filter.end(), top) - m_filter.begin());
+        bottom = int(std::upper_bound(m_filter.begin(), m_filter.end(), bottom) - m_filter.begin()) - 1;
+        if (bottom < top)
+            return;
+    }
+
+    emit dataChanged(index(top, left), index(bottom, right));
+}
@@ -0,0 +1,76 @@
+#ifndef TABLEMODEL_H
+#define TABLEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QSharedPointer>
+
+#include "cellstore.h"
+#include "statistics.h"
+
+class CommandCenter;
+class CsvFile;
+struct CsvBatch;
+
+// Shows the rows of a cell store, or only those picked by a filter. The
+// view works with its own row numbers, commands and raw modifications with
+// rows of the store.
+class TableModel : public QAbstractTableModel {
+    Q_OBJECT
+public:
+    TableModel(QObject * parent);
+
+    void setCommandCenter(CommandCenter * cc) { m_cc = cc; }
+    CellStore & store() { return m_store; }
+    Statistics & statistics() { return m_stats; }
+
+    // rows of the store to show, in order; kept when rows are removed or
+    // reordered, rows inserted are shown as well
+    void setFilter(const QVector<int> &rows);
+    void clearFilter();
+    bool isFiltered() const { return m_filtered; }
+    int storeRow(int row) const;
+    // row of the view showing a row of the store, -1 when filtered out
+    int viewRow(int storeRow) const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    QVariant headerData(int section, Qt::Orientation orientation,
+                        int role = Qt::DisplayRole) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+
+    // undoable, goes through the command center
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole);
+
+    // raw modifications, used by commands
+    void setCellText(int r, int c, const QString &text);
+    // the same without telling views, cellsChanged() does that once for a
+    // batch of cells
+    void writeCellText(int r, int c, const QString &text);
+    void cellsChanged(int top, int left, int bottom, int right);
+    void setRange(int top, int left, int bottom, int right, const CellGrid &grid);
+    void setRows(const QVector<int> &rows, int left, int right, const CellGrid &grid);
+    void appendColumn(const QString &title);
+    void removeLastColumn();
+    void insertRowIds(int at, const QVector<int> &rows);
+    QVector<int> removeRowIds(int at, int count);
+    void setRowOrder(const QVector<int> &order);
+    void reset();
+    void load(const QVector<CellGrid> &grids);
+    void attach(QSharedPointer<CsvFile> file);
+    void appendSourceRows(const CsvBatch &batch);
+
+private:
+    void _storeRowsChanged(int top, int left, int bottom, int right);
+
+private:
+    CommandCenter * m_cc;
+    CellStore m_store;
+    // kept current by the raw modifications below
+    Statistics m_stats;
+
+    bool m_filtered;
+    QVector<int> m_filter;
+};
+
+#endif // TABLEMODEL_H
@@ -1,305 +1,369 @@
 #include "tablewidget.h"
-#include <QStack>
+#include "tablemodel.h"
+#include "commandcenter.h"
+#include "csvloader.h"
+#include "expression.h"
+#include "finder.h"
+#include "rowfilter.h"
+#include "csv.h"
 
-class CommandCenter;
+#include <QBuffer>
+#include <QHeaderView>
+#include <QStyle>
 
-class Command {
-public:
-    virtual void redo(QTableWidget * tw, CommandCenter * cc) = 0;
-    virtual void undo(QTableWidget * tw, CommandCenter * cc) = 0;
-    virtual ~Command() {}
-};
+#include <algorithm>
+#include <random>
 
-class MyTableWidgetItem : public QTableWidgetItem {
-public:
-    MyTableWidgetItem(CommandCenter * cc, QString text);
-    virtual void setData(int role, const QVariant &value);
+// rows measured from the head, the tail and at random when sizing columns
+static const int SAMPLE_ROWS = 64;
 
-private:
-    CommandCenter * m_cc;
-};
+// copyRange() writes this many rows between progress updates
+static const int COPY_BLOCK = 16384;
 
+////////////////////////////////////////////////////////////////////////////////
+/// TableWidget
 
-class SetDataCommand : public Command {
-public:
-    SetDataCommand(int i, int j, int role, QVariant oldData, QVariant newData)
-        : m_i(i), m_j(j), m_role(role), m_oldData(oldData), m_newData(newData)
-    {
-
-    }
-
-    ~SetDataCommand() {
+TableWidget::TableWidget(QWidget *parent)
+    : QWidget(parent)
+{
+    m_model = new TableModel(this);
 
-    }
+    m_tv = new QTableView(this);
+    m_tv->setModel(m_model);
+    m_layout = new QBoxLayout(QBoxLayout::LeftToRight, this);
+    m_layout->setContentsMargins(0, 0, 0, 0);
+    m_layout->addWidget(m_tv);
 
-    void redo(QTableWidget *tw, CommandCenter *) {
-        QTableWidgetItem* item = tw->item(m_i, m_j);
-        item->QTableWidgetItem::setData(m_role, m_newData);
-    }
+    m_cc = new CommandCenter(this, m_tv, m_model);
+    m_model->setCommandCenter(m_cc);
 
-    void undo(QTableWidget *tw, CommandCenter *) {
-        QTableWidgetItem* item = tw->item(m_i, m_j);
-        item->QTableWidgetItem::setData(m_role, m_oldData);
-    }
+    connect(m_cc, SIGNAL(commited()), this, SIGNAL(changed()));
+    connect(m_cc, SIGNAL(undone()), this, SIGNAL(changed()));
+    connect(m_cc, SIGNAL(redone()), this, SIGNAL(changed()));
+    connect(m_tv->selectionModel(), SIGNAL(selectionChanged(QItemSelection,QItemSelection)),
+            this, SIGNAL(selectionChanged()));
+}
 
-private:
-    int m_i;
-    int m_j;
-    int m_role;
-    QVariant m_oldData;
-    QVariant m_newData;
-};
-
-class AddColumnCommand : public Command {
-public:
-    AddColumnCommand(const QString &title)
-        : m_title(title)
-    {
-    }
+void TableWidget::reset()
+{
+    m_model->reset();
+    m_cc->clear();
+}
 
-    ~AddColumnCommand() {
-    }
+void TableWidget::attach(QSharedPointer<CsvFile> file)
+{
+    m_model->attach(file);
+    m_cc->clear();
+}
 
-    void redo(QTableWidget *tw, CommandCenter * cc) {
-        int col = tw->columnCount();
-        tw->setColumnCount(col + 1);
-        tw->setHorizontalHeaderItem(col, new MyTableWidgetItem(cc, m_title));
+void TableWidget::sortRows(const QVector<SortKey> &keys)
+{
+    if (keys.isEmpty() || rowCount() < 2)
+        return;
 
-        for (int i = 0; i < tw->rowCount(); ++i) {
-            tw->setItem(i, col, new MyTableWidgetItem(cc, ""));
-        }
-    }
+    m_cc->addCommand(new SortRowsCommand(keys));
+}
 
-    void undo(QTableWidget *tw, CommandCenter *) {
-        int col = tw->columnCount();
-        tw->setColumnCount(col - 1);
-    }
-private:
-    QString m_title;
-};
+void TableWidget::load(const QVector<CellGrid> &grids)
+{
+    m_model->load(grids);
+    m_cc->clear();
+}
 
-struct CommandGroup : public QList<QSharedPointer<Command>>
+void TableWidget::appendSourceRows(const CsvBatch &batch)
 {
-    QString name;
+    m_model->appendSourceRows(batch);
+}
 
-    QList<QTableWidgetSelectionRange> prevSelection;
-    QList<QTableWidgetSelectionRange> postSelection;
-};
+void TableWidget::materialize()
+{
+    m_model->store().materialize();
+    // rows got new ids, commands still refer to the old ones
+    m_cc->clear();
+}
 
-class CommandCenter : public QObject {
-    Q_OBJECT
+void TableWidget::write(CSV::Writer &writer)
+{
+    m_model->store().write(writer);
+}
 
-public:
-    CommandCenter(QObject * parent, QTableWidget * tw)
-        : QObject(parent), m_tw(tw), m_curStatus(0)
-    {
-    }
+const CellStore & TableWidget::store()
+{
+    return m_model->store();
+}
 
-    void begin(const QString &name) {
-        if (m_transStack.empty()) {
-            while (m_history.length() > m_curStatus) {
-                m_history.pop_back();
-            }
+int TableWidget::columnCount()
+{
+    return m_model->store().columnCount();
+}
 
-            m_history.push_back(CommandGroup());
-            m_history.last().name = name;
-            m_history.last().prevSelection = m_tw->selectedRanges();
-        }
+int TableWidget::rowCount()
+{
+    return m_model->rowCount();
+}
 
-        m_transStack.push(name);
-    }
+QString TableWidget::text(int r, int c)
+{
+    return m_model->store().text(m_model->storeRow(r), c);
+}
 
-    void addCommand(Command * cmd) {
-        if (!m_transStack.empty()) {
-            m_history.last().append(QSharedPointer<Command>(cmd));
-            cmd->redo(m_tw, this);
-        } else {
-            begin(QString());
-            addCommand(cmd);
-            commit();
-        }
-    }
+void TableWidget::setText(int r, int c, const QString &text)
+{
+    m_model->setData(m_model->index(r, c), text);
+}
 
-    void commit() {
-        if (m_transStack.empty())
-            return;
+QString TableWidget::header(int c)
+{
+    return m_model->store().header(c);
+}
 
-        m_transStack.pop();
+void TableWidget::setRange(const TableWidgetSelection &range, const QList<QStringList> &grid)
+{
+    if (grid.isEmpty())
+        return;
 
-        if (m_transStack.empty()) {
-            if (m_history.last().length() > 0) {
-                m_curStatus += 1;
-                m_history.last().postSelection = m_tw->selectedRanges();
-            }
-            else
-                m_history.pop_back();
+    setRange(range, CellGrid(grid));
+}
 
-            emit commited();
-        }
+void TableWidget::setRange(const TableWidgetSelection &range, const CellGrid &grid)
+{
+    if (grid.rowCount() == 0 || range.top < 0 || range.left < 0)
+        return;
+
+    if (m_model->isFiltered()) {
+        m_cc->addCommand(new SetRangeCommand(_storeRows(range.top, range.bottom),
+                                             range.left, range.right, grid));
+    } else {
+        m_cc->addCommand(new SetRangeCommand(range.top, range.left, range.bottom, range.right,
+                                             grid));
     }
+}
 
-    void undo() {
-        if (m_curStatus == 0)
-            return;
-
-        CommandGroup & g = m_history[m_curStatus - 1];
-        for (int i = g.length() - 1; i >= 0; --i) {
-            g[i]->undo(m_tw, this);
-        }
-
-        m_tw->clearSelection();
-        for (auto & s : g.prevSelection)
-            m_tw->setRangeSelected(s, true);
-
-        m_curStatus -= 1;
-
-        emit undone();
-    }
+void TableWidget::fillRange(const TableWidgetSelection &range, const QString &text)
+{
+    setRange(range, QList<QStringList>() << (QStringList() << text));
+}
 
-    void redo() {
-        if (m_curStatus >= m_history.length())
-            return;
+void TableWidget::clearRange(const TableWidgetSelection &range)
+{
+    fillRange(range, QString());
+}
 
-        CommandGroup & g = m_history[m_curStatus];
-        for (int i = 0; i < g.length(); ++i) {
-            g[i]->redo(m_tw, this);
-        }
+void TableWidget::copyColumn(int from, int to)
+{
+    // every row, also those a filter hides
+    int rows = m_model->store().rowCount();
+    if (rows == 0)
+        return;
+
+    CellGrid grid;
+    m_model->store().readRange(0, from, rows - 1, from, grid);
+    m_cc->addCommand(new SetRangeCommand(0, to, rows - 1, to, grid));
+}
 
-        m_tw->clearSelection();
-        for (auto & s : g.postSelection)
-            m_tw->setRangeSelected(s, true);
+void TableWidget::computeColumn(int col, const Expression &expression)
+{
+    // every row, also those a filter hides
+    int rows = m_model->store().rowCount();
+    if (rows == 0)
+        return;
 
-        m_curStatus += 1;
+    m_cc->addCommand(new SetRangeCommand(0, col, rows - 1, col, expression.evaluate(m_model->store())));
+}
 
-        emit redone();
-    }
+QByteArray TableWidget::copyRange(const TableWidgetSelection &range, QAtomicInt * progress)
+{
+    QByteArray csv;
+    if (range.top < 0 || range.left < 0)
+        return csv;
 
-    void clear() {
-        m_history.clear();
-        m_curStatus = 0;
-        m_transStack.clear();
+    QVector<int> columns;
+    for (int c = range.left; c <= range.right; ++c) {
+        columns.append(c);
     }
 
-    int length() {
-        return m_history.length();
+    // one buffer for the whole payload, rows are written into it block by
+    // block without a string per cell
+    QBuffer buffer(&csv);
+    buffer.open(QIODevice::WriteOnly);
+    CSV::Writer writer(&buffer);
+
+    int rows = range.bottom - range.top + 1;
+    for (int begin = 0; begin < rows; begin += COPY_BLOCK) {
+        int end = qMin(begin + COPY_BLOCK, rows);
+        m_model->store().writeRows(writer, _storeRows(range.top + begin, range.top + end - 1), columns);
+        if (progress) {
+            progress->store(int(qint64(end) * 1000 / rows));
+        }
     }
-
-signals:
-    void commited();
-    void undone();
-    void redone();
-
-private:
-    QTableWidget * m_tw;
-    QList<CommandGroup> m_history;
-    int m_curStatus;
-    QStack<QString> m_transStack;
-};
-
-
-
-MyTableWidgetItem::MyTableWidgetItem(CommandCenter * cc, QString text)
-    : QTableWidgetItem(text)
-    , m_cc(cc)
-{
+    writer.flush();
+    return csv;
 }
 
-void MyTableWidgetItem::setData(int role, const QVariant &value) {
-    Command * cmd = new SetDataCommand(this->row(), this->column(), role, this->data(role), value);
-    m_cc->addCommand(cmd);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-/// TableWidget
-
-TableWidget::TableWidget(QWidget *parent)
-    : QWidget(parent)
+int TableWidget::applyFilter(const RowFilter &filter)
 {
-    m_tw = new QTableWidget(this);
-    m_layout = new QBoxLayout(QBoxLayout::LeftToRight, this);
-    m_layout->setContentsMargins(0, 0, 0, 0);
-    m_layout->addWidget(m_tw);
-
-    m_cc = new CommandCenter(this, m_tw);
-
-    connect(m_cc, SIGNAL(commited()), this, SIGNAL(changed()));
-    connect(m_cc, SIGNAL(undone()), this, SIGNAL(changed()));
-    connect(m_cc, SIGNAL(redone()), this, SIGNAL(changed()));
+    QVector<int> rows = filter.evaluate(m_model->store());
+    m_model->setFilter(rows);
+    return rows.size();
 }
 
-void TableWidget::reset()
+void TableWidget::clearFilter()
 {
-    m_tw->setRowCount(0);
-    m_tw->setColumnCount(0);
-    m_cc->clear();
+    m_model->clearFilter();
 }
 
-int TableWidget::columnCount()
+bool TableWidget::isFiltered()
 {
-    return m_tw->columnCount();
+    return m_model->isFiltered();
 }
 
-int TableWidget::rowCount()
+int TableWidget::addColumn(QString title)
 {
-    return m_tw->rowCount();
+    m_cc->addCommand(new AddColumnCommand(title));
+    return columnCount() - 1;
 }
 
-QString TableWidget::text(int r, int c)
+void TableWidget::addRow(QStringList row)
 {
-    return m_tw->item(r, c)->text();
+    TableWidgetTransaction ts(this, "Add Row");
+
+    // at the end of the store, shown under a filter as well
+    int r = m_model->store().rowCount();
+    m_cc->addCommand(new InsertRowsCommand(r, 1));
+
+    TableWidgetSelection range;
+    range.row = range.top = range.bottom = m_model->viewRow(r);
+    range.col = range.left = 0;
+    range.right = qMin(row.length(), columnCount()) - 1;
+    if (range.right >= 0) {
+        setRange(range, QList<QStringList>() << row);
+    }
 }
 
-void TableWidget::setText(int r, int c, const QString &text)
+void TableWidget::insertRows(int at, int count)
 {
-    m_tw->item(r, c)->setText(text);
+    if (count <= 0)
+        return;
+
+    int r = at < rowCount() ? m_model->storeRow(at) : m_model->store().rowCount();
+    m_cc->addCommand(new InsertRowsCommand(r, count));
 }
 
-QString TableWidget::header(int c)
+void TableWidget::removeRows(int at, int count)
 {
-    return m_tw->horizontalHeaderItem(c)->text();
+    if (count <= 0)
+        return;
+
+    // filtered rows are spread over the store, remove them run by run from
+    // the bottom up, so the runs above keep their place
+    QVector<int> rows = _storeRows(at, at + count - 1);
+
+    TableWidgetTransaction ts(this, "Remove Rows");
+    int end = rows.size();
+    while (end > 0) {
+        int begin = end - 1;
+        while (begin > 0 && rows[begin - 1] == rows[begin] - 1) {
+            --begin;
+        }
+        m_cc->addCommand(new RemoveRowsCommand(rows[begin], end - begin));
+        end = begin;
+    }
 }
 
-int TableWidget::addColumn(QString title)
+bool TableWidget::findNext(const Finder &finder)
 {
-    m_cc->addCommand(new AddColumnCommand(title));
-    return m_tw->columnCount() - 1;
+    QModelIndex current = m_tv->currentIndex();
+    int row = current.isValid() ? m_model->storeRow(current.row()) : -1;
+    int col = current.isValid() ? current.column() : -1;
+
+    // matches a filter hides are skipped, until we come around again
+    int firstRow = -1;
+    int firstCol = -1;
+    int view = -1;
+    while (view < 0) {
+        if (!finder.findNext(m_model->store(), row, col))
+            return false;
+        if (row == firstRow && col == firstCol)
+            return false;
+        if (firstRow < 0) {
+            firstRow = row;
+            firstCol = col;
+        }
+        view = m_model->viewRow(row);
+    }
+
+    QModelIndex found = m_model->index(view, col);
+    m_tv->setCurrentIndex(found);
+    m_tv->scrollTo(found);
+    return true;
 }
 
-void TableWidget::addRow(QStringList cont)
+int TableWidget::replaceAll(const Finder &finder, const QString &with)
 {
-    // TODO undo support
-    int row = m_tw->rowCount();
-    m_tw->setRowCount(row + 1);
+    QVector<QPoint> hits = finder.findAll(m_model->store());
+
+    // with a filter, only the rows shown
+    SetCellsCommand * cmd = new SetCellsCommand;
+    int count = 0;
+    foreach (const QPoint &hit, hits) {
+        if (m_model->viewRow(hit.y()) < 0)
+            continue;
+        QString old = m_model->store().text(hit.y(), hit.x());
+        cmd->add(hit.y(), hit.x(), old, finder.replace(old, with));
+        count += 1;
+    }
 
-    for (int i = 0; i < m_tw->columnCount(); ++i) {
-        QString text = i >= cont.length() ? "" : cont[i];
-        m_tw->setItem(row, i, new MyTableWidgetItem(m_cc, text));
+    if (count == 0) {
+        delete cmd;
+        return 0;
     }
+
+    TableWidgetTransaction ts(this, "Replace All");
+    m_cc->addCommand(cmd);
+    return count;
 }
 
 TableWidgetSelection TableWidget::selection()
 {
     TableWidgetSelection sel;
-    sel.row = m_tw->currentItem()->row();
-    sel.col = m_tw->currentItem()->column();
+    QModelIndex current = m_tv->currentIndex();
+    sel.row = current.row();
+    sel.col = current.column();
+
+    QItemSelection ranges = m_tv->selectionModel()->selection();
+    if (ranges.isEmpty()) {
+        sel.left = sel.right = sel.col;
+        sel.top = sel.bottom = sel.row;
+        return sel;
+    }
 
-    QTableWidgetSelectionRange rg = m_tw->selectedRanges()[0];
-    sel.left = rg.leftColumn();
-    sel.top = rg.topRow();
-    sel.right = rg.rightColumn();
-    sel.bottom = rg.bottomRow();
+    QItemSelectionRange rg = ranges[0];
+    sel.left = rg.left();
+    sel.top = rg.top();
+    sel.right = rg.right();
+    sel.bottom = rg.bottom();
 
     return sel;
 }
 
+Statistics::Summary TableWidget::statistics(const TableWidgetSelection &range, bool &column)
+{
+    column = range.left == range.right && (range.top == range.bottom
+            || (range.top == 0 && range.bottom == rowCount() - 1 && !isFiltered()));
+    if (column) {
+        return m_model->statistics().column(range.left);
+    }
+    return m_model->statistics().rows(_storeRows(range.top, range.bottom), range.left, range.right);
+}
+
 void TableWidget::resizeColumnsToContents()
 {
-    m_tw->resizeColumnsToContents();
+    _resizeColumns(0, columnCount() - 1);
 }
 
 void TableWidget::resizeColumnToContents(int col)
 {
-    m_tw->resizeColumnToContents(col);
+    _resizeColumns(col, col);
 }
 
 void TableWidget::undo()
@@ -312,6 +376,77 @@ void TableWidget::redo()
     m_cc->redo();
 }
 
+void TableWidget::setUndoLimits(qint64 bytes, int steps)
+{
+    m_cc->setLimits(bytes, steps);
+}
+
+void TableWidget::_resizeColumns(int first, int last)
+{
+    // measuring every cell like QTableView does takes longer than loading
+    // a big file, so only a sample of rows is measured, plus the widest
+    // value the store has seen written to each column
+    if (first > last)
+        return;
+
+    QFontMetrics fm = m_tv->fontMetrics();
+    int margin = 2 * (m_tv->style()->pixelMetric(QStyle::PM_FocusFrameHMargin, nullptr, m_tv) + 1);
+
+    QVector<int> widths(last - first + 1, 0);
+    foreach (int r, _sampleRows()) {
+        for (int c = first; c <= last; ++c) {
+            int w = fm.boundingRect(text(r, c)).width();
+            widths[c - first] = qMax(widths[c - first], w);
+        }
+    }
+
+    for (int c = first; c <= last; ++c) {
+        int w = qMax(widths[c - first], fm.boundingRect(m_model->store().widestText(c)).width());
+        w = qMax(w + margin, m_tv->horizontalHeader()->sectionSizeHint(c));
+        m_tv->setColumnWidth(c, w);
+    }
+}
+
+QVector<int> TableWidget::_sampleRows()
+{
+    int rows = rowCount();
+    QVector<int> sample;
+
+    if (rows <= SAMPLE_ROWS * 3) {
+        for (int r = 0; r < rows; ++r) {
+            sample.append(r);
+        }
+        return sample;
+    }
+
+    for (int r = 0; r < SAMPLE_ROWS; ++r) {
+        sample.append(r);
+    }
+    // same seed every time, so sizing does not jump around between runs
+    std::minstd_rand random(rows);
+    std::uniform_int_distribution<int> middle(SAMPLE_ROWS, rows - SAMPLE_ROWS - 1);
+    for (int i = 0; i < SAMPLE_ROWS; ++i) {
+        sample.append(middle(random));
+    }
+    for (int r = rows - SAMPLE_ROWS; r < rows; ++r) {
+        sample.append(r);
+    }
+
+    // in order, neighbouring rows of an attached file are decoded once
+    std::sort(sample.begin(), sample.end());
+    return sample;
+}
+
+QVector<int> TableWidget::_storeRows(int top, int bottom)
+{
+    QVector<int> rows;
+    rows.reserve(bottom - top + 1);
+    for (int r = top; r <= bottom; ++r) {
+        rows.append(m_model->storeRow(r));
+    }
+    return rows;
+}
+
 void TableWidget::_beginTransaction(const QString &name)
 {
     m_cc->begin(name);
@@ -321,6 +456,3 @@ void TableWidget::_commitTransaction()
 {
     m_cc->commit();
 }
-
-
-#include "tablewidget.moc"
@@ -2,10 +2,24 @@
 #define TABLEWIDGET_H
 
 #include <QWidget>
-#include <QTableWidget>
+#include <QTableView>
 #include <QBoxLayout>
+#include <QSharedPointer>
 
+#include "statistics.h"
+
+class QAtomicInt;
 class CommandCenter;
+class TableModel;
+class CellStore;
+class CellGrid;
+class CsvFile;
+class Expression;
+class Finder;
+class RowFilter;
+struct CsvBatch;
+struct SortKey;
+namespace CSV { class Writer; }
 struct TableWidgetSelection;
 
 class TableWidget : public QWidget
@@ -17,6 +31,12 @@ public:
     explicit TableWidget(QWidget *parent = nullptr);
 
     void reset();
+    void attach(QSharedPointer<CsvFile> file);
+    void appendSourceRows(const CsvBatch &batch);
+    // drops the undo history, rows are numbered anew
+    void materialize();
+    void write(CSV::Writer &writer);
+    const CellStore & store();
 
     int columnCount();
     int rowCount();
@@ -24,26 +44,67 @@ public:
     void setText(int r, int c, const QString &text);
     QString header(int c);
 
+    // one pass over the range and one undo step, the grid is repeated
+    // when the range is larger
+    void setRange(const TableWidgetSelection &range, const QList<QStringList> &grid);
+    void setRange(const TableWidgetSelection &range, const CellGrid &grid);
+    void fillRange(const TableWidgetSelection &range, const QString &text);
+    void clearRange(const TableWidgetSelection &range);
+    void copyColumn(int from, int to);
+    // every row gets the value of the expression, in one undo step
+    void computeColumn(int col, const Expression &expression);
+    // the range as csv, written straight from the store with `progress`
+    // going from 0 to 1000; may run on another thread while nothing edits
+    // the table
+    QByteArray copyRange(const TableWidgetSelection &range, QAtomicInt * progress = nullptr);
+
+    // only the matching rows are shown, edits go to those rows; returns
+    // the number of rows shown
+    int applyFilter(const RowFilter &filter);
+    void clearFilter();
+    bool isFiltered();
+
+    // the first row of the grids is the header
+    void load(const QVector<CellGrid> &grids);
+
     int addColumn(QString title);
     void addRow(QStringList row);
+    void insertRows(int at, int count);
+    void removeRows(int at, int count);
+    void sortRows(const QVector<SortKey> &keys);
+
+    // moves to the next match, false when there is none
+    bool findNext(const Finder &finder);
+    // one undo step, returns the number of cells changed
+    int replaceAll(const Finder &finder, const QString &with);
 
     TableWidgetSelection selection();
+    // the whole column when a single cell or the full column is selected,
+    // else the cells selected
+    Statistics::Summary statistics(const TableWidgetSelection &range, bool &column);
     void resizeColumnsToContents();
     void resizeColumnToContents(int col);
 
     void undo();
     void redo();
+    void setUndoLimits(qint64 bytes, int steps);
 
 private:
+    void _resizeColumns(int first, int last);
+    QVector<int> _sampleRows();
+    QVector<int> _storeRows(int top, int bottom);
+
     void _beginTransaction(const QString &name);
     void _commitTransaction();
 
 signals:
     void changed();
+    void selectionChanged();
 
 private:
     QBoxLayout * m_layout;
-    QTableWidget * m_tw;
+    QTableView * m_tv;
+    TableModel * m_model;
     CommandCenter * m_cc;
 };
 
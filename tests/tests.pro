@@ -0,0 +1,29 @@
+QT       += core gui widgets concurrent testlib
+
+TARGET = tests
+TEMPLATE = app
+CONFIG += testcase
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        tst_csveditor.cpp \
+        ../csv.cpp \
+        ../csvfile.cpp \
+        ../csvloader.cpp \
+        ../tablemodel.cpp \
+        ../commandcenter.cpp \
+        ../cellstore.cpp \
+        ../sorter.cpp \
+        ../rowfilter.cpp \
+        ../expression.cpp \
+        ../exprlexer.cpp \
+        ../finder.cpp \
+        ../tablewidget.cpp \
+        ../statistics.cpp
+
+HEADERS += \
+        ../csvloader.h \
+        ../commandcenter.h \
+        ../tablemodel.h \
+        ../tablewidget.h
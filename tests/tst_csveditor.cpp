@@ -0,0 +1,909 @@
+#include <QtTest>
+#include <QTableView>
+#include <QTextCodec>
+
+#include "cellstore.h"
+#include "csv.h"
+#include "csvfile.h"
+#include "csvtokenizer.h"
+#include "expression.h"
+#include "finder.h"
+#include "rowfilter.h"
+#include "sorter.h"
+#include "commandcenter.h"
+#include "tablemodel.h"
+#include "tablewidget.h"
+
+namespace
+{
+    typedef QList<QList<QByteArray> > Rows;
+
+    // the state machine the tokenizer replaced, run over the data with
+    // crlf read as lf and a final newline implied
+    Rows parseClassic(QByteArray data, char delimiter, char quote)
+    {
+        data.replace("\r\n", "\n");
+        if (!data.endsWith('\n'))
+            data += '\n';
+
+        enum State {Normal, Quote} state = Normal;
+        Rows rows;
+        QList<QByteArray> line;
+        QByteArray value;
+        for (int i = 0; i < data.size(); ++i) {
+            char current = data[i];
+            if (state == Normal) {
+                if (current == '\n') {
+                    line.append(value);
+                    value.clear();
+                    rows.append(line);
+                    line.clear();
+                } else if (current == delimiter) {
+                    line.append(value);
+                    value.clear();
+                } else if (current == quote) {
+                    state = Quote;
+                } else {
+                    value += current;
+                }
+            } else if (current == quote) {
+                if (i + 1 < data.size() && data[i + 1] == quote) {
+                    value += quote;
+                    ++i;
+                } else {
+                    state = Normal;
+                }
+            } else {
+                value += current;
+            }
+        }
+        return rows;
+    }
+
+    struct RowsHandler
+    {
+        explicit RowsHandler(char quote) : quote(quote) {}
+
+        void field(const char * begin, const char * end, bool escaped)
+        {
+            if (escaped) {
+                CSV::unescape(begin, end, unescaped, quote);
+                line.append(QByteArray(unescaped.constData(), unescaped.size()));
+            } else {
+                line.append(QByteArray(begin, int(end - begin)));
+            }
+        }
+
+        void row(qint64)
+        {
+            rows.append(line);
+            line.clear();
+        }
+
+        char quote;
+        Rows rows;
+        QList<QByteArray> line;
+        QByteArray unescaped;
+    };
+
+    // a quoted field with a run of newlines every few rows, so that chunks
+    // start inside quotes as often as outside
+    QByteArray quotedLines(int rows)
+    {
+        QByteArray data;
+        for (int r = 0; r < rows; ++r) {
+            data += QByteArray::number(r) + ",\"multi\nline\n\"\"q\"\"\",plain\n";
+            if (r % 7 == 0)
+                data += "\"" + QByteArray(300, '\n') + "\",x\n";
+        }
+        return data;
+    }
+
+    Rows rowsOf(const QVector<CellGrid> &grids)
+    {
+        Rows rows;
+        foreach (const CellGrid &grid, grids) {
+            for (int r = 0; r < grid.rowCount(); ++r) {
+                QList<QByteArray> line;
+                for (int c = 0; c < grid.columnCount(r); ++c) {
+                    line.append(QByteArray(grid.data(r, c), grid.length(r, c)));
+                }
+                rows.append(line);
+            }
+        }
+        return rows;
+    }
+
+    QList<QStringList> statusRows()
+    {
+        QList<QStringList> rows;
+        rows << (QStringList() << "status" << "latency" << "host name")
+             << (QStringList() << "OK" << "120" << "a.example")
+             << (QStringList() << "FAILED" << "800" << "b.example")
+             << (QStringList() << "FAILED" << "90" << "c.example")
+             << (QStringList() << "OK" << "" << "d.example")
+             << (QStringList() << "WARN" << "1000" << "a.example");
+        return rows;
+    }
+
+    QStringList headersOf(const CellStore &store)
+    {
+        QStringList headers;
+        for (int c = 0; c < store.columnCount(); ++c) {
+            headers << store.header(c);
+        }
+        return headers;
+    }
+
+    // the computed cells, or the error
+    QStringList compute(const QString &expr, const CellStore &store)
+    {
+        Expression expression;
+        if (!expression.compile(expr, headersOf(store)))
+            return QStringList() << "error: " + expression.errorString();
+
+        CellGrid grid = expression.evaluate(store);
+        QStringList cells;
+        for (int r = 0; r < grid.rowCount(); ++r) {
+            cells << QString::fromUtf8(grid.data(r, 0), grid.length(r, 0));
+        }
+        return cells;
+    }
+
+    // a file large enough for its index to be saved
+    void writeLargeFile(const QString &path)
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QByteArray bytes("id,name,note\n");
+        for (int r = 0; bytes.size() < (17 << 20); ++r) {
+            bytes += QByteArray::number(r) + ",abcdefghij,\"klmnopqrstuvwxyz, and more\"\n";
+        }
+        QCOMPARE(file.write(bytes), qint64(bytes.size()));
+    }
+
+    // a change to the file that keeps its modification time
+    void changeKeepingTime(const QString &path, qint64 at, const QByteArray &bytes)
+    {
+        QDateTime modified = QFileInfo(path).lastModified();
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QVERIFY(file.seek(at < 0 ? file.size() : at));
+        QCOMPARE(file.write(bytes), qint64(bytes.size()));
+        QVERIFY(file.flush());
+        QVERIFY(file.setFileTime(modified, QFileDevice::FileModificationTime));
+    }
+
+    // whether open() took the rows from the saved index
+    bool indexLoaded(const QString &path)
+    {
+        CsvFile file;
+        return file.open(path, false) && file.indexed() == file.size();
+    }
+
+    QString indexPathOf(const QString &path)
+    {
+        QByteArray key = QFileInfo(path).absoluteFilePath().toUtf8();
+        return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/index/"
+               + QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex() + ".idx";
+    }
+
+    template <class Scan>
+    Rows tokenizeWith(const QByteArray &data, const CSV::Dialect &dialect)
+    {
+        RowsHandler handler(dialect.quote);
+        CSV::tokenize<Scan>(data.constData(), data.size(), handler, dialect);
+        return handler.rows;
+    }
+}
+
+class TestCsvEditor : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void statisticsFollowUndo();
+    void typedStatistics();
+    void adjacentEditsMerge();
+    void writeKeepsEncoding();
+    void incrementalSaveKeepsMark();
+    void writerMarkOnce();
+    void tokenizerMatchesStateMachine_data();
+    void tokenizerMatchesStateMachine();
+    void chunksMatchOnePass();
+    void parallelParseMatchesOnePass();
+    void expressionValues_data();
+    void expressionValues();
+    void expressionErrors();
+    void sortStableAcrossMerge();
+    void sortDatesAsUtc();
+    void filterRows_data();
+    void filterRows();
+    void filterErrors();
+    void editThroughFilter();
+    void findInFile();
+    void replaceAllOneStep();
+    void staleIndexIgnored();
+    void damagedIndexIgnored();
+};
+
+void TestCsvEditor::initTestCase()
+{
+    // saved indexes go to a cache of their own
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void TestCsvEditor::statisticsFollowUndo()
+{
+    TableModel model(nullptr);
+    QTableView view;
+    view.setModel(&model);
+    CommandCenter cc(nullptr, &view, &model);
+    model.setCommandCenter(&cc);
+
+    QList<QStringList> rows;
+    rows << (QStringList() << "n") << (QStringList() << "1") << (QStringList() << "5")
+         << (QStringList() << "3");
+    model.load(QVector<CellGrid>() << CellGrid(rows));
+
+    Statistics::Summary s = model.statistics().column(0);
+    QCOMPARE(s.sum, 9.0);
+    QCOMPARE(s.min, 1.0);
+    QCOMPARE(s.max, 5.0);
+
+    // the largest value is edited away and comes back with undo
+    cc.addEdit(1, 0, "5", "10");
+    s = model.statistics().column(0);
+    QCOMPARE(s.sum, 14.0);
+    QCOMPARE(s.max, 10.0);
+
+    cc.undo();
+    s = model.statistics().column(0);
+    QCOMPARE(s.sum, 9.0);
+    QCOMPARE(s.min, 1.0);
+    QCOMPARE(s.max, 5.0);
+
+    cc.redo();
+    s = model.statistics().column(0);
+    QCOMPARE(s.sum, 14.0);
+    QCOMPARE(s.max, 10.0);
+}
+
+void TestCsvEditor::typedStatistics()
+{
+    TableModel model(nullptr);
+    QTableView view;
+    view.setModel(&model);
+    CommandCenter cc(nullptr, &view, &model);
+    model.setCommandCenter(&cc);
+
+    QList<QStringList> rows;
+    rows << (QStringList() << "int" << "dec" << "when" << "big")
+         << (QStringList() << "12" << "1.50" << "2021-01-01" << "1")
+         << (QStringList() << "-7" << "-0.25" << "2021-01-02" << "2")
+         << (QStringList() << "" << "10.00" << "2021-01-01" << "99999999999999999999")
+         << (QStringList() << "30" << "" << "" << "3");
+    model.load(QVector<CellGrid>() << CellGrid(rows));
+
+    const CellStore &store = model.store();
+    QCOMPARE(store.columnType(0), CellStore::Integer);
+    QCOMPARE(store.columnType(1), CellStore::Decimal);
+    QCOMPARE(store.columnType(2), CellStore::Timestamp);
+    // 20 digits do not fit into the packed values
+    QVERIFY(store.columnType(3) != CellStore::Integer);
+
+    Statistics::Summary s = model.statistics().column(0);
+    QCOMPARE(s.cells, qint64(4));
+    QCOMPARE(s.empty, qint64(1));
+    QCOMPARE(s.numbers, qint64(3));
+    QCOMPARE(s.sum, 35.0);
+    QCOMPARE(s.min, -7.0);
+    QCOMPARE(s.max, 30.0);
+
+    s = model.statistics().column(1);
+    QCOMPARE(s.numbers, qint64(3));
+    QCOMPARE(s.sum, 11.25);
+    QCOMPARE(s.min, -0.25);
+    QCOMPARE(s.max, 10.0);
+
+    // timestamps are counted, not summed
+    s = model.statistics().column(2);
+    QCOMPARE(s.numbers, qint64(0));
+    QCOMPARE(s.distinct, qint64(2));
+    QCOMPARE(s.empty, qint64(1));
+
+    s = model.statistics().column(3);
+    QCOMPARE(s.numbers, qint64(4));
+    QCOMPARE(s.max, 1e20);
+
+    // edits that do not fit turn the columns into text, the numbers stay
+    cc.addEdit(0, 0, "12", "twelve");
+    QCOMPARE(store.columnType(0), CellStore::Text);
+    s = model.statistics().column(0);
+    QCOMPARE(s.numbers, qint64(2));
+    QCOMPARE(s.sum, 23.0);
+    QCOMPARE(s.min, -7.0);
+
+    cc.undo();
+    s = model.statistics().column(0);
+    QCOMPARE(s.numbers, qint64(3));
+    QCOMPARE(s.sum, 35.0);
+
+    cc.addEdit(2, 1, "10.00", "10.0");
+    QCOMPARE(store.columnType(1), CellStore::Text);
+    s = model.statistics().column(1);
+    QCOMPARE(s.numbers, qint64(3));
+    QCOMPARE(s.sum, 11.25);
+    QCOMPARE(store.text(0, 1), QString("1.50"));
+}
+
+void TestCsvEditor::adjacentEditsMerge()
+{
+    TableModel model(nullptr);
+    QTableView view;
+    view.setModel(&model);
+    CommandCenter cc(nullptr, &view, &model);
+    model.setCommandCenter(&cc);
+
+    QList<QStringList> rows;
+    rows << (QStringList() << "a" << "b") << (QStringList() << "1" << "2")
+         << (QStringList() << "3" << "4") << (QStringList() << "5" << "6");
+    model.load(QVector<CellGrid>() << CellGrid(rows));
+
+    // down a column is one step, a cell further away starts the next
+    cc.addEdit(0, 0, "1", "x");
+    cc.addEdit(1, 0, "3", "y");
+    cc.addEdit(2, 0, "5", "z");
+    cc.addEdit(0, 1, "2", "w");
+    QCOMPARE(cc.length(), 2);
+
+    cc.undo();
+    QCOMPARE(model.store().text(0, 1), QString("2"));
+    QCOMPARE(model.store().text(2, 0), QString("z"));
+
+    cc.undo();
+    QCOMPARE(model.store().text(0, 0), QString("1"));
+    QCOMPARE(model.store().text(1, 0), QString("3"));
+    QCOMPARE(model.store().text(2, 0), QString("5"));
+}
+
+void TestCsvEditor::writeKeepsEncoding()
+{
+    QString text = QString::fromUtf8("name,city\nRen\xC3\xA9,Z\xC3\xBCrich\n\"a, b\",\xE2\x82\xAC\n");
+    QByteArray bytes("\xFF\xFE", 2);
+    bytes += QTextCodec::codecForName("UTF-16LE")->fromUnicode(text);
+
+    CSV::Dialect dialect = CSV::sniff(bytes.constData(), bytes.size());
+    QCOMPARE(dialect.codec, QByteArray("UTF-16LE"));
+    QCOMPARE(dialect.bom, 2);
+
+    CellStore store;
+    store.load(CSV::parseGrids(bytes, dialect));
+    QCOMPARE(store.text(0, 0), QString::fromUtf8("Ren\xC3\xA9"));
+
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    {
+        CSV::Writer writer(&buffer, dialect);
+        store.write(writer);
+        QVERIFY(writer.flush());
+    }
+    QCOMPARE(buffer.data(), bytes);
+}
+
+void TestCsvEditor::incrementalSaveKeepsMark()
+{
+    QTemporaryFile input;
+    QVERIFY(input.open());
+    input.write("\xEF\xBB\xBFname,n\nfoo,1\nbar,2\n");
+    input.close();
+
+    QSharedPointer<CsvFile> file(new CsvFile);
+    QVERIFY(file->open(input.fileName()));
+    QCOMPARE(file->dialect().bom, 3);
+
+    CellStore store;
+    store.attach(file);
+    store.setText(1, 0, "baz");
+
+    CSV::Dialect dialect = file->dialect();
+    dialect.crlf = file->crlf();
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    {
+        CSV::Writer writer(&buffer, dialect);
+        store.write(writer);
+        QVERIFY(writer.flush());
+    }
+    QCOMPARE(buffer.data(), QByteArray("\xEF\xBB\xBFname,n\nfoo,1\nbaz,2\n"));
+}
+
+void TestCsvEditor::writerMarkOnce()
+{
+    CSV::Dialect dialect;
+    dialect.bom = 3;
+
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    CSV::Writer writer(&buffer, dialect);
+    QVERIFY(writer.flush());
+    writer.writeField(QString("a"));
+    writer.endRow();
+    QVERIFY(writer.flush());
+    writer.writeField(QString("b"));
+    writer.endRow();
+    QVERIFY(writer.flush());
+    QCOMPARE(buffer.data(), QByteArray("\xEF\xBB\xBF" "a\nb\n"));
+}
+
+void TestCsvEditor::tokenizerMatchesStateMachine_data()
+{
+    QTest::addColumn<QByteArray>("input");
+
+    QTest::newRow("plain") << QByteArray("a,b,c\n1,2,3\n");
+    QTest::newRow("doubled quotes") << QByteArray("\"say \"\"hi\"\"\",x\n\"\"\"\",\"\"\n");
+    QTest::newRow("quoted delimiter") << QByteArray("\"a,b\",c\n");
+    QTest::newRow("quoted lf") << QByteArray("\"a\nb\",c\nd,e\n");
+    QTest::newRow("quoted crlf") << QByteArray("\"a\r\nb\",c\r\nd,e\r\n");
+    QTest::newRow("lone cr") << QByteArray("a\rb,c\nd\r,e\n");
+    QTest::newRow("no final newline") << QByteArray("a,b\nc,d");
+    QTest::newRow("empty fields") << QByteArray(",,\n,\n\n");
+    QTest::newRow("quote inside field") << QByteArray("a\"b,c\"d\n");
+    QTest::newRow("unterminated quote") << QByteArray("a,b\nc,\"d\ne,f\n");
+
+    // a doubled quote, a crlf and whole fields cut by the 64 byte blocks
+    QTest::newRow("doubled quote across blocks") << QByteArray(59, 'x') + ",\"ab\"\"c\",d\n";
+    QTest::newRow("crlf across blocks") << QByteArray(63, 'y') + "\r\nz\r\n";
+    QByteArray field = "a,\"" + QByteArray(100, 'q') + ",\n\"\"" + QByteArray(50, 'r') + "\",b\n";
+    QTest::newRow("field across blocks") << QByteArray(40, 'p') + field + field;
+}
+
+void TestCsvEditor::tokenizerMatchesStateMachine()
+{
+    QFETCH(QByteArray, input);
+
+    // the compiled variants for , ; tab and | and the runtime one
+    const char delimiters[] = { ',', ';', '\t', '|', ':' };
+    const char quotes[] = { '"', '\'' };
+
+    for (int d = 0; d < int(sizeof(delimiters)); ++d) {
+        for (int q = 0; q < int(sizeof(quotes)); ++q) {
+            CSV::Dialect dialect;
+            dialect.delimiter = delimiters[d];
+            dialect.quote = quotes[q];
+
+            QByteArray data = input;
+            data.replace(',', dialect.delimiter);
+            data.replace('"', dialect.quote);
+            Rows expected = parseClassic(data, dialect.delimiter, dialect.quote);
+
+            QCOMPARE(tokenizeWith<CSV::Detail::ScalarScan>(data, dialect), expected);
+#ifdef CSV_TOKENIZER_SSE2
+            QCOMPARE(tokenizeWith<CSV::Detail::Sse2Scan>(data, dialect), expected);
+#endif
+#ifdef CSV_TOKENIZER_AVX2
+            QCOMPARE(tokenizeWith<CSV::Detail::Avx2Scan>(data, dialect), expected);
+#endif
+        }
+    }
+}
+
+void TestCsvEditor::chunksMatchOnePass()
+{
+    QByteArray data = quotedLines(200);
+    CSV::Dialect dialect;
+    Rows expected = tokenizeWith<CSV::Detail::BestScan>(data, dialect);
+
+    // every chunk is tokenized on its own, as the threads of a load do
+    for (int count = 1; count <= 64; ++count) {
+        QVector<qint64> bounds = CSV::splitRows(data.constData(), data.size(), count, dialect.quote);
+        QCOMPARE(bounds.first(), qint64(0));
+        QCOMPARE(bounds.last(), qint64(data.size()));
+
+        RowsHandler handler(dialect.quote);
+        for (int k = 0; k + 1 < bounds.size(); ++k) {
+            QVERIFY(bounds[k] < bounds[k + 1]);
+            CSV::tokenize(data.constData() + bounds[k], bounds[k + 1] - bounds[k], handler, dialect);
+        }
+        QCOMPARE(handler.rows, expected);
+    }
+}
+
+void TestCsvEditor::parallelParseMatchesOnePass()
+{
+    // large enough to be parsed in parallel chunks on more than one core
+    QByteArray data = quotedLines(80000);
+    QVERIFY(data.size() > (4 << 20));
+
+    CSV::Dialect dialect;
+    QCOMPARE(rowsOf(CSV::parseGrids(data, dialect)),
+             tokenizeWith<CSV::Detail::BestScan>(data, dialect));
+}
+
+void TestCsvEditor::expressionValues_data()
+{
+    QTest::addColumn<QString>("expr");
+    QTest::addColumn<QStringList>("expected");
+
+    // a b t
+    // 2 3 x
+    //   4 hello
+    // 10 -1 h\u00e9llo
+    QTest::newRow("product first") << "a + b * 2" << (QStringList() << "8" << "" << "8");
+    QTest::newRow("parentheses") << "(a + b) * 2" << (QStringList() << "10" << "" << "18");
+    QTest::newRow("unary minus") << "-a + 1" << (QStringList() << "-1" << "" << "-9");
+    QTest::newRow("and before or") << "a > 5 || b > 3 && t == 'x'" << (QStringList() << "0" << "0" << "1");
+    QTest::newRow("comparison after sum") << "a + 1 == 3" << (QStringList() << "1" << "0" << "0");
+
+    QTest::newRow("text times number") << "t * 2" << (QStringList() << "" << "" << "");
+    QTest::newRow("string plus number") << "'abc' + 1" << (QStringList() << "" << "" << "");
+    QTest::newRow("number as text") << "concat(b, t)" << (QStringList() << "3x" << "4hello" << QString::fromUtf8("-1h\xC3\xA9llo"));
+
+    QTest::newRow("empty plus one") << "a + 1" << (QStringList() << "3" << "" << "11");
+    QTest::newRow("empty divisor") << "b / a" << (QStringList() << "1.5" << "" << "-0.1");
+    QTest::newRow("empty in concat") << "concat(a, '-', t)" << (QStringList() << "2-x" << "-hello" << QString::fromUtf8("10-h\xC3\xA9llo"));
+    QTest::newRow("empty length") << "len(a)" << (QStringList() << "1" << "0" << "2");
+    QTest::newRow("empty is false") << "if(a, 'yes', 'no')" << (QStringList() << "yes" << "no" << "yes");
+
+    QTest::newRow("substr") << "substr(t, 1, 3)" << (QStringList() << "" << "ell" << QString::fromUtf8("\xC3\xA9ll"));
+    QTest::newRow("substr past end") << "substr(t, 10)" << (QStringList() << "" << "" << "");
+    QTest::newRow("substr before start") << "substr(t, -5, 2)" << (QStringList() << "x" << "he" << QString::fromUtf8("h\xC3\xA9"));
+    QTest::newRow("substr infinite length") << "substr(t, 0, 1e300 * 1e300)" << (QStringList() << "x" << "hello" << QString::fromUtf8("h\xC3\xA9llo"));
+    QTest::newRow("substr infinite start") << "substr(t, 1e300 * 1e300)" << (QStringList() << "" << "" << "");
+    QTest::newRow("substr empty start") << "substr(t, a / 0, 1)" << (QStringList() << "x" << "h" << "h");
+}
+
+void TestCsvEditor::expressionValues()
+{
+    QFETCH(QString, expr);
+    QFETCH(QStringList, expected);
+
+    QList<QStringList> rows;
+    rows << (QStringList() << "a" << "b" << "t")
+         << (QStringList() << "2" << "3" << "x")
+         << (QStringList() << "" << "4" << "hello")
+         << (QStringList() << "10" << "-1" << QString::fromUtf8("h\xC3\xA9llo"));
+    CellStore store;
+    store.load(QVector<CellGrid>() << CellGrid(rows));
+
+    QCOMPARE(compute(expr, store), expected);
+}
+
+void TestCsvEditor::expressionErrors()
+{
+    QList<QStringList> rows;
+    rows << (QStringList() << "a") << (QStringList() << "1");
+    CellStore store;
+    store.load(QVector<CellGrid>() << CellGrid(rows));
+
+    QStringList exprs;
+    exprs << "a +" << "nosuch + 1" << "len(a, 1)" << "nosuch(a)" << "substr(a)"
+          << "'open" << "(a + 1" << "a 1";
+    foreach (const QString &expr, exprs) {
+        Expression expression;
+        QVERIFY2(!expression.compile(expr, headersOf(store)), qPrintable(expr));
+        QVERIFY(!expression.errorString().isEmpty());
+    }
+}
+
+void TestCsvEditor::sortStableAcrossMerge()
+{
+    // enough rows for a run per core and several merges, with few keys
+    // and a text column so both kinds of key are read
+    QList<QStringList> rows;
+    rows << (QStringList() << "key" << "name" << "row");
+    for (int r = 0; r < 200000; ++r) {
+        QString key = r % 7 == 0 ? QString() : QString::number(r % 3);
+        rows << (QStringList() << key << QString("n%1").arg(r % 5) << QString::number(r));
+    }
+    CellStore store;
+    store.load(QVector<CellGrid>() << CellGrid(rows));
+    QCOMPARE(store.rowCount(), 200000);
+
+    QList<QVector<SortKey> > sorts;
+    sorts << (QVector<SortKey>() << SortKey{0, Qt::AscendingOrder})
+          << (QVector<SortKey>() << SortKey{0, Qt::DescendingOrder})
+          << (QVector<SortKey>() << SortKey{1, Qt::DescendingOrder} << SortKey{0, Qt::AscendingOrder});
+
+    foreach (const QVector<SortKey> &keys, sorts) {
+        QVector<int> order = Sorter(keys).sort(store);
+        QCOMPARE(order.size(), store.rowCount());
+
+        // rows with the same keys keep their order
+        for (int i = 1; i < order.size(); ++i) {
+            int a = order[i - 1];
+            int b = order[i];
+            bool same = true;
+            foreach (const SortKey &key, keys) {
+                same = same && store.text(a, key.column) == store.text(b, key.column);
+            }
+            if (same)
+                QVERIFY2(a < b, qPrintable(QString("rows %1 and %2").arg(a).arg(b)));
+        }
+        // empty keys go last
+        QVERIFY(store.text(order.last(), 0).isEmpty());
+    }
+}
+
+void TestCsvEditor::sortDatesAsUtc()
+{
+    // mixed layouts keep the column text, so the sorter parses the dates.
+    // 02:30 falls in the spring gap of many time zones
+    QList<QStringList> rows;
+    rows << (QStringList() << "when")
+         << (QStringList() << "2021-03-28T03:10:00")
+         << (QStringList() << "2021-03-28 02:30:00")
+         << (QStringList() << "2021-03-28")
+         << (QStringList() << "2021-03-28 02:15:00");
+    CellStore store;
+    store.load(QVector<CellGrid>() << CellGrid(rows));
+
+    QVector<int> order = Sorter(QVector<SortKey>() << SortKey{0, Qt::AscendingOrder}).sort(store);
+    QCOMPARE(order, QVector<int>() << 2 << 3 << 1 << 0);
+}
+
+void TestCsvEditor::filterRows_data()
+{
+    QTest::addColumn<QString>("expr");
+    QTest::addColumn<QVector<int> >("rows");
+
+    QTest::newRow("text") << "status == \"FAILED\"" << (QVector<int>() << 1 << 2);
+    QTest::newRow("single =") << "status = 'OK'" << (QVector<int>() << 0 << 3);
+    QTest::newRow("and") << "status == \"FAILED\" && latency > 500" << (QVector<int>() << 1);
+    QTest::newRow("or") << "status != \"OK\" || latency < 100" << (QVector<int>() << 1 << 2 << 4);
+    QTest::newRow("not") << "!(status == \"OK\")" << (QVector<int>() << 1 << 2 << 4);
+    // an empty cell is no number
+    QTest::newRow("number") << "latency > 100" << (QVector<int>() << 0 << 1 << 4);
+    QTest::newRow("negative") << "latency >= -5" << (QVector<int>() << 0 << 1 << 2 << 4);
+    QTest::newRow("empty") << "latency == \"\"" << (QVector<int>() << 3);
+    QTest::newRow("contains") << "`host name` ~ \"a.\"" << (QVector<int>() << 0 << 4);
+    QTest::newRow("none") << "status == \"DOWN\"" << QVector<int>();
+}
+
+void TestCsvEditor::filterRows()
+{
+    QFETCH(QString, expr);
+    QFETCH(QVector<int>, rows);
+
+    CellStore store;
+    store.load(QVector<CellGrid>() << CellGrid(statusRows()));
+
+    RowFilter filter;
+    QVERIFY2(filter.compile(expr, headersOf(store)), qPrintable(filter.errorString()));
+    QCOMPARE(filter.evaluate(store), rows);
+}
+
+void TestCsvEditor::filterErrors()
+{
+    CellStore store;
+    store.load(QVector<CellGrid>() << CellGrid(statusRows()));
+
+    QStringList exprs;
+    exprs << "status ==" << "nosuch == 1" << "status == \"open" << "(status == \"OK\""
+          << "status \"OK\"" << "host name ~ a";
+    foreach (const QString &expr, exprs) {
+        RowFilter filter;
+        QVERIFY2(!filter.compile(expr, headersOf(store)), qPrintable(expr));
+        QVERIFY(!filter.errorString().isEmpty());
+    }
+}
+
+void TestCsvEditor::editThroughFilter()
+{
+    TableWidget tw;
+    tw.load(QVector<CellGrid>() << CellGrid(statusRows()));
+
+    RowFilter filter;
+    QVERIFY(filter.compile("status == \"FAILED\"", QStringList() << "status" << "latency" << "host name"));
+    QCOMPARE(tw.applyFilter(filter), 2);
+
+    // rows of the view are the rows shown
+    tw.setText(1, 1, "95");
+    QCOMPARE(tw.store().text(2, 1), QString("95"));
+    QCOMPARE(tw.store().text(1, 1), QString("800"));
+
+    // inserted rows are shown, the filter stays
+    tw.insertRows(0, 1);
+    QVERIFY(tw.isFiltered());
+    QCOMPARE(tw.rowCount(), 3);
+    QCOMPARE(tw.text(0, 0), QString());
+    QCOMPARE(tw.text(1, 1), QString("800"));
+    QCOMPARE(tw.text(2, 1), QString("95"));
+
+    tw.removeRows(0, 1);
+    QVERIFY(tw.isFiltered());
+    QCOMPARE(tw.rowCount(), 2);
+    QCOMPARE(tw.store().rowCount(), 5);
+    QCOMPARE(tw.text(0, 1), QString("800"));
+
+    // sorting keeps the same rows, in their new order
+    tw.sortRows(QVector<SortKey>() << SortKey{1, Qt::AscendingOrder});
+    QVERIFY(tw.isFiltered());
+    QCOMPARE(tw.rowCount(), 2);
+    QCOMPARE(tw.text(0, 1), QString("95"));
+    QCOMPARE(tw.text(1, 1), QString("800"));
+
+    tw.undo();
+    QCOMPARE(tw.text(0, 1), QString("800"));
+    QCOMPARE(tw.text(1, 1), QString("95"));
+
+    tw.addRow(QStringList() << "NEW" << "1");
+    QCOMPARE(tw.rowCount(), 3);
+    QCOMPARE(tw.text(2, 0), QString("NEW"));
+    QCOMPARE(tw.text(2, 1), QString("1"));
+
+    tw.undo();
+    QCOMPARE(tw.rowCount(), 2);
+    QCOMPARE(tw.store().rowCount(), 5);
+}
+
+void TestCsvEditor::findInFile()
+{
+    QTemporaryFile input;
+    QVERIFY(input.open());
+    input.write("\xEF\xBB\xBFname,note\n"
+                "alpha,\"a, quoted field\"\n"
+                "beta,\"say \"\"hi\"\"\"\n"
+                "gamma,plain\n"
+                "\xC3\x84rger,\xC3\x89COLE\n");
+    input.close();
+
+    QSharedPointer<CsvFile> file(new CsvFile);
+    QVERIFY(file->open(input.fileName()));
+    CellStore store;
+    store.attach(file);
+    QCOMPARE(store.rowCount(), 4);
+
+    struct Case
+    {
+        const char * text;
+        bool caseSensitive;
+        QVector<QPoint> hits;
+    };
+    const Case cases[] = {
+        // the first row comes right after the byte order mark and header
+        { "alpha", true, QVector<QPoint>() << QPoint(0, 0) },
+        { "a, quoted", true, QVector<QPoint>() << QPoint(1, 0) },
+        { "quoted field", true, QVector<QPoint>() << QPoint(1, 0) },
+        // doubled quotes in the file
+        { "say \"hi\"", true, QVector<QPoint>() << QPoint(1, 1) },
+        { "\"hi\"", false, QVector<QPoint>() << QPoint(1, 1) },
+        { "GAMMA", false, QVector<QPoint>() << QPoint(0, 2) },
+        { "gamma", true, QVector<QPoint>() << QPoint(0, 2) },
+        { "\xC3\xA4rger", false, QVector<QPoint>() << QPoint(0, 3) },
+        { "\xC3\xA9cole", false, QVector<QPoint>() << QPoint(1, 3) },
+        { "\xC3\xA9cole", true, QVector<QPoint>() },
+        { "\xC3\x84rger", true, QVector<QPoint>() << QPoint(0, 3) },
+        // an umlaut is no plain letter
+        { "a", false, QVector<QPoint>() << QPoint(0, 0) << QPoint(1, 0) << QPoint(0, 1)
+                                        << QPoint(1, 1) << QPoint(0, 2) << QPoint(1, 2) },
+        { "missing", false, QVector<QPoint>() },
+    };
+    for (const Case &c : cases) {
+        Finder finder(QString::fromUtf8(c.text), false, c.caseSensitive);
+        QVERIFY(finder.isValid());
+        QCOMPARE(finder.findAll(store), c.hits);
+    }
+
+    // an edited cell of a row whose bytes do not match
+    store.setText(2, 1, "now quoted");
+    QCOMPARE(Finder("now", false, true).findAll(store), QVector<QPoint>() << QPoint(1, 2));
+    QCOMPARE(Finder("plain", false, true).findAll(store), QVector<QPoint>());
+}
+
+void TestCsvEditor::replaceAllOneStep()
+{
+    TableWidget tw;
+    QList<QStringList> rows;
+    rows << (QStringList() << "a" << "b") << (QStringList() << "cat" << "hat")
+         << (QStringList() << "bat" << "dog") << (QStringList() << "cap" << "at");
+    tw.load(QVector<CellGrid>() << CellGrid(rows));
+
+    tw.setText(1, 1, "fog");
+    QCOMPARE(tw.replaceAll(Finder("a", false, true), "o"), 5);
+    QCOMPARE(tw.text(0, 0), QString("cot"));
+    QCOMPARE(tw.text(2, 1), QString("ot"));
+
+    // one undo takes back every replacement and nothing else
+    tw.undo();
+    QCOMPARE(tw.text(0, 0), QString("cat"));
+    QCOMPARE(tw.text(0, 1), QString("hat"));
+    QCOMPARE(tw.text(1, 0), QString("bat"));
+    QCOMPARE(tw.text(2, 0), QString("cap"));
+    QCOMPARE(tw.text(2, 1), QString("at"));
+    QCOMPARE(tw.text(1, 1), QString("fog"));
+
+    tw.redo();
+    QCOMPARE(tw.text(1, 0), QString("bot"));
+    QCOMPARE(tw.text(2, 0), QString("cop"));
+}
+
+void TestCsvEditor::staleIndexIgnored()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("large.csv");
+    writeLargeFile(path);
+
+    CsvFile file;
+    QVERIFY(file.open(path));
+    int rows = file.rowCount();
+    file.close();
+    QVERIFY(QFile::exists(indexPathOf(path)));
+    QVERIFY(indexLoaded(path));
+
+    // the same size and time, other bytes at the start
+    changeKeepingTime(path, 20, "X");
+    QVERIFY(!indexLoaded(path));
+
+    // a longer file at the same time
+    QVERIFY(file.open(path));
+    file.close();
+    QVERIFY(indexLoaded(path));
+    changeKeepingTime(path, -1, "1,a,b\n");
+    QVERIFY(!indexLoaded(path));
+
+    // a newer file with the same bytes
+    QVERIFY(file.open(path));
+    QCOMPARE(file.rowCount(), rows + 1);
+    file.close();
+    QVERIFY(indexLoaded(path));
+    {
+        QFile touched(path);
+        QVERIFY(touched.open(QIODevice::ReadWrite));
+        QVERIFY(touched.setFileTime(QFileInfo(path).lastModified().addSecs(60),
+                                    QFileDevice::FileModificationTime));
+    }
+    QVERIFY(!indexLoaded(path));
+}
+
+void TestCsvEditor::damagedIndexIgnored()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString path = dir.filePath("large.csv");
+    writeLargeFile(path);
+
+    CsvFile file;
+    QVERIFY(file.open(path));
+    int rows = file.rowCount();
+    qint64 size = file.size();
+    file.close();
+
+    QFile index(indexPathOf(path));
+    QVERIFY(index.open(QIODevice::ReadOnly));
+    QByteArray saved = index.readAll();
+    index.close();
+    QVERIFY(indexLoaded(path));
+
+    // the marks are the end of the index, the last one is the last eight
+    // bytes
+    uchar * last = reinterpret_cast<uchar *>(saved.data() + saved.size() - 8);
+    qint64 mark = qFromBigEndian<qint64>(last);
+    QList<qint64> bad;
+    bad << mark + 1 << size + 64 << 0;
+    foreach (qint64 value, bad) {
+        QByteArray damaged = saved;
+        qToBigEndian<qint64>(value, reinterpret_cast<uchar *>(damaged.data() + damaged.size() - 8));
+        QVERIFY(index.open(QIODevice::WriteOnly));
+        index.write(damaged);
+        index.close();
+
+        QVERIFY2(!indexLoaded(path), qPrintable(QString::number(value)));
+        // the rows are still found, by a scan
+        QVERIFY(file.open(path));
+        QCOMPARE(file.rowCount(), rows);
+        file.close();
+    }
+
+    // cut short
+    QVERIFY(index.open(QIODevice::WriteOnly));
+    index.write(saved.left(saved.size() - 4));
+    index.close();
+    QVERIFY(!indexLoaded(path));
+}
+
+QTEST_MAIN(TestCsvEditor)
+
+#include "tst_csveditor.moc"